@@ -1,233 +1,411 @@
 //==--- tools/clang-check/ClangInterpreter.cpp - Clang Interpreter tool
 //--------------===//
 //===----------------------------------------------------------------------===//
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <list>
+#include <map>
+#include <mutex>
 
 #include "clang/AST/ASTConsumer.h"
-#include "clang/AST/EvaluatedExprVisitor.h"
+#include "clang/AST/StmtVisitor.h"
+#include "clang/Frontend/ASTUnit.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
 
 using namespace clang;
 
+#include "Batch.h"
+#include "BytecodeCompiler.h"
+#include "Daemon.h"
 #include "Environment.h"
+#include "InterpreterVisitor.h"
+#include "Jit.h"
+#include "ProgramCache.h"
+#include "Profiler.h"
+#include "Sampler.h"
+#include "StackBudget.h"
+#include "VM.h"
 
-class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor> {
-   public:
-    explicit InterpreterVisitor(const ASTContext &context, Environment *env)
-        : EvaluatedExprVisitor(context), mEnv(env) {}
-    virtual ~InterpreterVisitor() {}
+/// Which engine executes the guest program
+enum Engine { ENGINE_AST, ENGINE_VM };
 
-    virtual void VisitWhileStmt(WhileStmt *whilestmt) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        Expr *cond = whilestmt->getCond();
-        Visit(cond);
-        int res = mEnv->expr(cond);
-        while (res == 1) {
-            Visit(whilestmt->getBody());
-            Visit(cond);
-            res = mEnv->expr(cond);
-            if (mEnv->isCurFuncReturned()) {
-                return;
-            }
-        }
-    }
+/// Command line options
+struct Options {
+    Engine engine = ENGINE_AST;
+    bool heapStats = false;  /// report heap usage when the program ends
+    /// Entries of the cache of pure function results, 0 disables it
+    unsigned long memoEntries = 0;
+    MemoCache::Policy memoPolicy = MemoCache::LRU;
+    bool memoStats = false;  /// report cache hits and misses
+    /// Calls or loop iterations after which code is compiled, 0 disables the
+    /// JIT
+    unsigned jitThreshold = 0;
+    bool jitStats = false;
+    /// Directory of lowered programs keyed by source hash, empty if none
+    std::string cacheDir;
+    /// Prefix of the files the profile is written to, empty if not profiling
+    std::string profile;
+    /// Prefix of the files the sampled stacks are written to, empty if not
+    /// sampling, and the samples per second of CPU time
+    std::string sample;
+    unsigned sampleRate = 997;
+    /// Socket to serve programs on, or of the daemon to send the program to
+    std::string serve;
+    std::string connect;
+    /// File of input sets to run the program over, one per line, the number
+    /// of threads running them (0 for all hardware threads), and whether to
+    /// report their throughput
+    std::string batchFile;
+    unsigned jobs = 0;
+    bool batchStats = false;
+    /// Read GET values without prompting, from inputFile if set, otherwise
+    /// from standard input, and buffer PRINT on standard output
+    bool nonInteractive = false;
+    std::string inputFile;
+    /// Bytes the guest call stack may take
+    unsigned long stackBudget = 1UL << 30;
+    /// Address space reserved for guest memory, 0 for the default
+    unsigned long guestMemory = 0;
+};
 
-    virtual void VisitForStmt(ForStmt *forstmt) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
+/// Run a lowered program on the VM, writing the statistics to report
+static void runBytecode(const Program &program, const Options &options,
+                        GuestIO *io, FILE *report) {
+    MemoCache memo(options.memoEntries, options.memoPolicy);
+    VM vm(program, options.guestMemory);
+    vm.setIO(io);
+    vm.setStackBudget(options.stackBudget);
+    if (options.memoEntries) vm.setMemo(&memo);
+    vm.run();
+    io->flush();
+    if (options.heapStats) vm.getHeap()->report(report);
+    if (options.memoStats) memo.report(report);
+}
 
-        Stmt *initstmt = forstmt->getInit();
-        if (initstmt) VisitStmt(initstmt);
-        Expr *cond = forstmt->getCond();
-        Expr *inc = forstmt->getInc();
-        Stmt *body = forstmt->getBody();
-        if (cond) {
-            Visit(cond);
-            int res = mEnv->expr(cond);
-            while (res == 1) {
-                Visit(body);
-                Visit(inc);
-                Visit(cond);
-                res = mEnv->expr(cond);
-                if (mEnv->isCurFuncReturned()) {
-                    return;
-                }
-            }
-        } else {
-            while (true) {
-                Visit(body);
-                Visit(inc);
-                if (mEnv->isCurFuncReturned()) {
-                    return;
-                }
-            }
+/// Walk the AST of a translation unit, writing the statistics to report and
+/// counting calls and statements in profiler if there is one. The AST is only
+/// read, all state lives in the Environment, and guest calls recurse on a
+/// host stack of the size of the stack budget. Only a single threaded caller
+/// may sample, the timer signal is process wide.
+static void runWalker(TranslationUnitDecl *unit, const Options &options,
+                      GuestIO *io, FILE *report, Profiler *profiler = NULL,
+                      bool sample = false) {
+    StackBudget::run(options.stackBudget, [&](const char *limit) {
+        Environment env(options.guestMemory);
+        InterpreterVisitor visitor(&env);
+        MemoCache memo(options.memoEntries, options.memoPolicy);
+        std::unique_ptr<Jit> jit;
+        env.setIO(io);
+        env.init(unit);
+        if (options.memoEntries) env.setMemo(&memo);
+        // native code is not profiled, so hot code stays in the walker
+        if (options.jitThreshold && !profiler) {
+            jit.reset(new Jit(env, options.jitThreshold));
+            visitor.setJit(jit.get());
         }
-    }
+        visitor.setProfiler(profiler);
+        visitor.setStackLimit(limit);
+        for (unsigned i = 0; i < env.getGlobals().size(); i++)
+            visitor.declare(env.getGlobals()[i]);
 
-    virtual void VisitIfStmt(IfStmt *ifstmt) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
+        FunctionDecl *entry = env.getEntry();
+        std::unique_ptr<Sampler> sampler;
+        if (sample) {
+            sampler.reset(new Sampler(env, options.sampleRate));
+            visitor.setTrackPC(true);
+            sampler->start();
         }
-        Expr *cond = ifstmt->getCond();
-        Visit(cond);
-        int res = mEnv->expr(cond);
-        if (res == 1) {
-            Visit(ifstmt->getThen());  // cannot use VisitStmt. do not know why
-        } else if (ifstmt->getElse()) {
-            Visit(ifstmt->getElse());
+        if (profiler) profiler->enter(entry);
+        visitor.run(entry->getBody());
+        io->flush();
+        if (profiler) profiler->exit();
+        if (sampler) {
+            sampler->stop();
+            if (!sampler->write(unit->getASTContext(), options.sample, report))
+                perror(options.sample.c_str());
         }
-    }
-
-    virtual void VisitParenExpr(ParenExpr *pexpr) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        VisitStmt(pexpr);
-        mEnv->parenexpr(pexpr);
-    }
+        if (options.heapStats) env.getHeap()->report(report);
+        if (options.memoStats) memo.report(report);
+        if (jit && options.jitStats) jit->report(report);
+    });
+}
 
-    virtual void VisitBinaryOperator(BinaryOperator *bop) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        //llvm::errs() << "VisitBinaryOperator.\n";
-        VisitStmt(bop);
-        mEnv->binop(bop);
-    }
-    virtual void VisitUnaryOperator(UnaryOperator *uop) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        VisitStmt(uop);
-        mEnv->unaryop(uop);
-    }
-    virtual void VisitDeclRefExpr(DeclRefExpr *expr) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        //llvm::errs() << "VisitDeclRefExpr.\n";
-        VisitStmt(expr);
-        mEnv->declref(expr);
-    }
+/// Lower the program if the options ask for the VM, storing it in the cache
+/// directory if there is one. Returns false if it has to be walked instead.
+static bool lower(TranslationUnitDecl *unit, llvm::StringRef source,
+                  const Options &options, Program &program) {
+    if (options.engine != ENGINE_VM && options.cacheDir.empty()) return false;
+    // only the walker profiles
+    if (!options.profile.empty() || !options.sample.empty()) return false;
+    if (!BytecodeCompiler(program).compile(unit)) return false;
+    if (!options.cacheDir.empty())
+        ProgramCache(options.cacheDir).store(source, program);
+    return true;
+}
 
-    virtual void VisitArraySubscriptExpr(ArraySubscriptExpr *expr) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        //printf("Visit Array\n\n");
-        Visit(expr->getLHS());
-        Visit(expr->getRHS());
-        mEnv->arrayref(expr);
-    }
+class InterpreterConsumer : public ASTConsumer {
+   public:
+    explicit InterpreterConsumer(const ASTContext &context,
+                                 const Options &options, GuestIO *io)
+        : mOptions(options), mIO(io) {}
+    virtual ~InterpreterConsumer() {}
 
-    virtual void VisitCastExpr(CastExpr *expr) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
+    virtual void HandleTranslationUnit(clang::ASTContext &Context) {
+        TranslationUnitDecl *decl = Context.getTranslationUnitDecl();
+        const SourceManager &sm = Context.getSourceManager();
+        Program program;
+        if (lower(decl, sm.getBufferData(sm.getMainFileID()), mOptions,
+                  program)) {
+            runBytecode(program, mOptions, mIO, stderr);
+        } else if (!mOptions.profile.empty()) {
+            Profiler profiler;
+            runWalker(decl, mOptions, mIO, stderr, &profiler,
+                      !mOptions.sample.empty());
+            if (!profiler.write(sm, mOptions.profile))
+                perror(mOptions.profile.c_str());
+        } else {
+            runWalker(decl, mOptions, mIO, stderr, NULL,
+                      !mOptions.sample.empty());
         }
-        //llvm::errs() << "VisitCastExpr.\n";
-        VisitStmt(expr);
-        mEnv->cast(expr);
     }
 
-    virtual void VisitReturnStmt(ReturnStmt *rets) {
-        //llvm::errs() << "VisitRtnStmt.\n";
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        Visit(rets->getRetValue());
-        mEnv->retstmt(rets);
-    }
+   private:
+    Options mOptions;
+    GuestIO *mIO;
+};
 
-    virtual void VisitCallExpr(CallExpr *call) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        //llvm::errs() << "VisitCallExpr.\n";
-        VisitStmt(call);
-        mEnv->call(call);
-        FunctionDecl *callee = call->getCalleeDecl()->getAsFunction();
-        if (mEnv->isExternalCall(callee)) return;
-        if (callee->hasBody()) {
-            VisitStmt(callee->getBody());
-        }
-        // return here
-        mEnv->ret(call);
-    }
+/// A program parsed once and then run any number of times, concurrently:
+/// lowered if the options ask for the VM and the compiler supports it,
+/// otherwise the AST the walker runs on. Runs only read it; each gets its own
+/// Environment or VM and with it its own Heap.
+class ParsedProgram {
+    std::unique_ptr<ASTUnit> mAST;
+    Program mProgram;
 
-    virtual void VisitDeclStmt(DeclStmt *declstmt) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        //llvm::errs() << "VisitDeclStmt.\n";
-        VisitStmt(declstmt);
-        mEnv->decl(declstmt);
+   public:
+    /// Returns NULL if source does not compile
+    static std::shared_ptr<ParsedProgram> parse(const std::string &source,
+                                                const Options &options) {
+        std::shared_ptr<ParsedProgram> parsed(new ParsedProgram());
+        if (!options.cacheDir.empty() &&
+            ProgramCache(options.cacheDir).load(source, parsed->mProgram))
+            return parsed;
+        parsed->mAST = clang::tooling::buildASTFromCode(source);
+        if (!parsed->mAST || parsed->mAST->getDiagnostics().hasErrorOccurred())
+            return std::shared_ptr<ParsedProgram>();
+        if (lower(parsed->mAST->getASTContext().getTranslationUnitDecl(),
+                  source, options, parsed->mProgram))
+            parsed->mAST.reset();
+        return parsed;
     }
 
-    virtual void VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *tte) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        //printf("sizeof expr\n");
-        VisitStmt(tte);
-        if (tte->getKind() == UETT_SizeOf) {
-            mEnv->sizeofexpr(tte);
-        }
+    void run(const Options &options, GuestIO *io, FILE *report) const {
+        if (mAST)
+            runWalker(mAST->getASTContext().getTranslationUnitDecl(), options,
+                      io, report);
+        else
+            runBytecode(mProgram, options, io, report);
     }
+};
 
-    virtual void VisitIntegerLiteral(IntegerLiteral *il) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        mEnv->integerLiteral(il);
-    }
+/// Programs the daemon has parsed, keyed by their source. Once full, the
+/// least recently requested program is dropped.
+class WarmCache {
+    static const unsigned kMaxPrograms = 256;
 
-    virtual void VisitCharacterLiteral(CharacterLiteral *cl) {
-        if (mEnv->isCurFuncReturned()) {
-            return;
-        }
-        mEnv->characterLiteral(cl);
-    }
+    typedef std::list<std::string> Recency;
+    struct Entry {
+        std::shared_ptr<ParsedProgram> parsed;
+        Recency::iterator recent;
+    };
 
-   private:
-    Environment *mEnv;
-};
+    Options mOptions;
+    std::mutex mLock;
+    std::map<std::string, Entry> mPrograms;
+    /// Sources from the most to the least recently requested
+    Recency mRecent;
 
-class InterpreterConsumer : public ASTConsumer {
    public:
-    explicit InterpreterConsumer(const ASTContext &context)
-        : mEnv(), mVisitor(context, &mEnv) {}
-    virtual ~InterpreterConsumer() {}
+    explicit WarmCache(const Options &options) : mOptions(options) {}
 
-    virtual void HandleTranslationUnit(clang::ASTContext &Context) {
-        TranslationUnitDecl *decl = Context.getTranslationUnitDecl();
-        mEnv.init(decl);
-
-        FunctionDecl *entry = mEnv.getEntry();
-        mVisitor.VisitStmt(entry->getBody());
+    /// Prepare one daemon request, the run happens in its worker
+    Daemon::Worker prepare(const std::string &source, FILE *out) {
+        std::shared_ptr<ParsedProgram> parsed = get(source);
+        if (!parsed) {
+            fputs("error: the program does not compile\n", out);
+            return Daemon::Worker();
+        }
+        const Options &options = mOptions;
+        return [parsed, &options](FILE *in, FILE *out) {
+            StreamIO io(in, out);
+            parsed->run(options, &io, out);
+        };
     }
 
    private:
-    Environment mEnv;
-    InterpreterVisitor mVisitor;
+    /// The daemon prepares one request at a time, so parsing under the
+    /// lock holds up no other client
+    std::shared_ptr<ParsedProgram> get(const std::string &source) {
+        std::lock_guard<std::mutex> guard(mLock);
+        std::map<std::string, Entry>::iterator it = mPrograms.find(source);
+        if (it != mPrograms.end()) {
+            mRecent.splice(mRecent.begin(), mRecent, it->second.recent);
+            return it->second.parsed;
+        }
+        std::shared_ptr<ParsedProgram> parsed =
+            ParsedProgram::parse(source, mOptions);
+        if (!parsed) return parsed;
+        if (mPrograms.size() >= kMaxPrograms) {
+            mPrograms.erase(mRecent.back());
+            mRecent.pop_back();
+        }
+        mRecent.push_front(source);
+        Entry entry = {parsed, mRecent.begin()};
+        mPrograms[source] = entry;
+        return parsed;
+    }
 };
 
+/// Run source once per input set of the batch file, then print the outputs
+/// in order
+static int runBatch(const std::string &source, const Options &options) {
+    Batch batch;
+    if (!batch.load(options.batchFile)) {
+        perror(options.batchFile.c_str());
+        return 1;
+    }
+    std::shared_ptr<ParsedProgram> parsed =
+        ParsedProgram::parse(source, options);
+    if (!parsed) return 1;
+    batch.run(
+        [&parsed, &options](GuestIO *io, FILE *out) {
+            parsed->run(options, io, out);
+        },
+        options.jobs);
+    batch.print(stderr);
+    if (options.batchStats) batch.report(stderr);
+    return 0;
+}
+
 class InterpreterClassAction : public ASTFrontendAction {
    public:
+    explicit InterpreterClassAction(const Options &options, GuestIO *io)
+        : mOptions(options), mIO(io) {}
+
     virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(
         clang::CompilerInstance &Compiler, llvm::StringRef InFile) {
         return std::unique_ptr<clang::ASTConsumer>(
-            new InterpreterConsumer(Compiler.getASTContext()));
+            new InterpreterConsumer(Compiler.getASTContext(), mOptions, mIO));
     }
+
+   private:
+    Options mOptions;
+    GuestIO *mIO;
 };
 
+/// Usage: ast-interpreter [--engine=ast|vm] [--heap-stats] [--memo=<entries>]
+///                        [--memo-policy=lru|fifo] [--memo-stats]
+///                        [--jit=<threshold>] [--jit-stats]
+///                        [--cache=<dir>] [--profile=<prefix>]
+///                        [--sample=<prefix>] [--sample-rate=<hz>]
+///                        [--non-interactive] [--input=<file>]
+///                        [--stack-budget=<MiB>] [--guest-memory=<MiB>]
+///                        <source>
+///        ast-interpreter [options] --batch=<inputs> [--jobs=<n>]
+///                        [--batch-stats] <source>
+///        ast-interpreter [options] --serve=<socket>
+///        ast-interpreter --connect=<socket> <source>
 int main(int argc, char **argv) {
-    if (argc > 1) {
+    Options options;
+    int arg = 1;
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++) {
+        if (!strcmp(argv[arg], "--engine=vm"))
+            options.engine = ENGINE_VM;
+        else if (!strcmp(argv[arg], "--engine=ast"))
+            options.engine = ENGINE_AST;
+        else if (!strcmp(argv[arg], "--heap-stats"))
+            options.heapStats = true;
+        else if (!strncmp(argv[arg], "--memo=", 7))
+            options.memoEntries = strtoul(argv[arg] + 7, NULL, 10);
+        else if (!strcmp(argv[arg], "--memo-policy=lru"))
+            options.memoPolicy = MemoCache::LRU;
+        else if (!strcmp(argv[arg], "--memo-policy=fifo"))
+            options.memoPolicy = MemoCache::FIFO;
+        else if (!strcmp(argv[arg], "--memo-stats"))
+            options.memoStats = true;
+        else if (!strncmp(argv[arg], "--jit=", 6))
+            options.jitThreshold = strtoul(argv[arg] + 6, NULL, 10);
+        else if (!strcmp(argv[arg], "--jit-stats"))
+            options.jitStats = true;
+        else if (!strncmp(argv[arg], "--cache=", 8))
+            options.cacheDir = argv[arg] + 8;
+        else if (!strncmp(argv[arg], "--profile=", 10))
+            options.profile = argv[arg] + 10;
+        else if (!strncmp(argv[arg], "--sample=", 9))
+            options.sample = argv[arg] + 9;
+        else if (!strncmp(argv[arg], "--sample-rate=", 14))
+            options.sampleRate = strtoul(argv[arg] + 14, NULL, 10);
+        else if (!strncmp(argv[arg], "--serve=", 8))
+            options.serve = argv[arg] + 8;
+        else if (!strncmp(argv[arg], "--connect=", 10))
+            options.connect = argv[arg] + 10;
+        else if (!strncmp(argv[arg], "--batch=", 8))
+            options.batchFile = argv[arg] + 8;
+        else if (!strncmp(argv[arg], "--jobs=", 7))
+            options.jobs = strtoul(argv[arg] + 7, NULL, 10);
+        else if (!strcmp(argv[arg], "--batch-stats"))
+            options.batchStats = true;
+        else if (!strcmp(argv[arg], "--non-interactive"))
+            options.nonInteractive = true;
+        else if (!strncmp(argv[arg], "--input=", 8))
+            options.inputFile = argv[arg] + 8;
+        else if (!strncmp(argv[arg], "--stack-budget=", 15))
+            options.stackBudget = strtoul(argv[arg] + 15, NULL, 10) << 20;
+        else if (!strncmp(argv[arg], "--guest-memory=", 15))
+            options.guestMemory = strtoul(argv[arg] + 15, NULL, 10) << 20;
+        else
+            llvm::errs() << "Unknown option " << argv[arg] << "\n";
+    }
+    if (!options.serve.empty()) {
+        WarmCache cache(options);
+        return Daemon::serve(
+            options.serve,
+            [&cache](const std::string &source, FILE *out) {
+                return cache.prepare(source, out);
+            });
+    }
+    if (arg < argc && !options.connect.empty())
+        return Daemon::request(options.connect, argv[arg]);
+    if (arg < argc && !options.batchFile.empty())
+        return runBatch(argv[arg], options);
+    if (arg < argc) {
+        GuestIO *io = consoleIO();
+        std::unique_ptr<FastIO> fastIO;
+        if (options.nonInteractive || !options.inputFile.empty()) {
+            int fd = STDIN_FILENO;
+            if (!options.inputFile.empty() &&
+                (fd = open(options.inputFile.c_str(), O_RDONLY)) < 0) {
+                perror(options.inputFile.c_str());
+                return 1;
+            }
+            fastIO.reset(new FastIO(fd, stdout));
+            io = fastIO.get();
+        }
+        // a cached program runs without starting the frontend
+        Program program;
+        if (!options.cacheDir.empty() && options.profile.empty() &&
+            options.sample.empty() &&
+            ProgramCache(options.cacheDir).load(argv[arg], program)) {
+            runBytecode(program, options, io, stderr);
+            return 0;
+        }
         clang::tooling::runToolOnCode(
-            std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction),
-            argv[1]);
+            std::unique_ptr<clang::FrontendAction>(
+                new InterpreterClassAction(options, io)),
+            argv[arg]);
     }
 }
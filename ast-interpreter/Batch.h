@@ -0,0 +1,128 @@
+//==--- Batch.h - One program run over many input sets in parallel -------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_BATCH_H
+#define AST_INTERPRETER_BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GuestIO.h"
+
+/// Input sets of a guest program, one per line of a file, each holding the
+/// numbers its GET calls read. Every set is a job; jobs run on a pool of
+/// threads and each collects its output in its own buffer, so the outputs
+/// can be printed in input order once all are done.
+class Batch {
+    struct Job {
+        std::string input;
+        std::string output;
+        double seconds;
+    };
+
+    std::vector<Job> mJobs;
+    unsigned mThreads;
+    double mSeconds;  /// wall time of the whole batch
+
+   public:
+    /// Runs the program once, reading GET input from io and writing PRINT
+    /// output and statistics to out
+    typedef std::function<void(GuestIO *io, FILE *out)> Runner;
+
+    Batch() : mJobs(), mThreads(0), mSeconds(0) {}
+
+    /// Read the input sets from path. Returns false if it cannot be read.
+    bool load(const std::string &path) {
+        std::ifstream in(path.c_str());
+        if (!in) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            Job job = {line + "\n", "", 0};
+            mJobs.push_back(job);
+        }
+        return true;
+    }
+
+    /// Run every job on threads workers, all hardware threads if 0
+    void run(const Runner &runner, unsigned threads) {
+        if (!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        mThreads =
+            std::min<size_t>(threads, std::max<size_t>(1, mJobs.size()));
+        std::atomic<size_t> next(0);
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < mThreads; i++)
+            workers.push_back(std::thread([this, &runner, &next] {
+                for (size_t j = next++; j < mJobs.size(); j = next++)
+                    runJob(runner, mJobs[j]);
+            }));
+        for (unsigned i = 0; i < workers.size(); i++) workers[i].join();
+        mSeconds = elapsed(start);
+    }
+
+    /// Write the outputs of the jobs in input order
+    void print(FILE *out) {
+        for (unsigned i = 0; i < mJobs.size(); i++)
+            fwrite(mJobs[i].output.data(), 1, mJobs[i].output.size(), out);
+    }
+
+    void report(FILE *out) {
+        double busy = 0;
+        for (unsigned i = 0; i < mJobs.size(); i++) {
+            fprintf(out, "Batch: job %u: %.3f ms, %.1f jobs/s\n", i,
+                    mJobs[i].seconds * 1e3,
+                    mJobs[i].seconds > 0 ? 1 / mJobs[i].seconds : 0.0);
+            busy += mJobs[i].seconds;
+        }
+        fprintf(out,
+                "Batch: %zu jobs in %.3f ms on %u threads, %.1f jobs/s, "
+                "%.2fx the sequential job time\n",
+                mJobs.size(), mSeconds * 1e3, mThreads,
+                mSeconds > 0 ? mJobs.size() / mSeconds : 0.0,
+                mSeconds > 0 ? busy / mSeconds : 0.0);
+    }
+
+   private:
+    static double elapsed(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+    }
+
+    /// The job reads its input set from memory and writes to a growing
+    /// buffer; there is nobody to prompt
+    static void runJob(const Runner &runner, Job &job) {
+        char *buf = NULL;
+        size_t size = 0;
+        FILE *in = fmemopen(&job.input[0], job.input.size(), "r");
+        FILE *out = open_memstream(&buf, &size);
+        if (!in || !out) {
+            if (in) fclose(in);
+            if (out) fclose(out);
+            free(buf);
+            job.output = "error: out of memory\n";
+            return;
+        }
+        StreamIO io(in, out, false);
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        runner(&io, out);
+        job.seconds = elapsed(start);
+        fclose(in);
+        fclose(out);
+        job.output.assign(buf, size);
+        free(buf);
+    }
+};
+
+#endif
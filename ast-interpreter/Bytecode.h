@@ -0,0 +1,118 @@
+//==--- Bytecode.h - Linear bytecode executed by the register VM ----------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_BYTECODE_H
+#define AST_INTERPRETER_BYTECODE_H
+
+#include <string>
+#include <vector>
+
+/// Opcodes of the register VM. Unless noted otherwise a, b and c name
+/// registers of the current frame.
+#define BYTECODE_OPCODES(X)                                               \
+    X(Nop)         /* */                                                  \
+    X(LoadImm)     /* r[a] = c */                                         \
+    X(LoadConst)   /* r[a] = constants[c] */                              \
+    X(Mov)         /* r[a] = r[b] */                                      \
+    X(LoadGlobal)  /* r[a] = globals[c] */                                \
+    X(StoreGlobal) /* globals[c] = r[a] */                                \
+    X(Add)         /* r[a] = r[b] + r[c] */                               \
+    X(Sub)         /* r[a] = r[b] - r[c] */                               \
+    X(Mul)         /* r[a] = r[b] * r[c] */                               \
+    X(Div)         /* r[a] = r[b] / r[c] */                               \
+    X(Rem)         /* r[a] = r[b] % r[c] */                               \
+    X(AddImm)      /* r[a] = r[b] + c */                                  \
+    X(MulImm)      /* r[a] = r[b] * c */                                  \
+    X(Neg)         /* r[a] = -r[b] */                                     \
+    X(Lt)          /* r[a] = r[b] < r[c] */                               \
+    X(Le)          /* r[a] = r[b] <= r[c] */                              \
+    X(Gt)          /* r[a] = r[b] > r[c] */                               \
+    X(Ge)          /* r[a] = r[b] >= r[c] */                              \
+    X(Eq)          /* r[a] = r[b] == r[c] */                              \
+    X(Ne)          /* r[a] = r[b] != r[c] */                              \
+    X(Jmp)         /* pc = c */                                           \
+    X(JmpZ)        /* if (r[a] == 0) pc = c */                            \
+    X(JmpNZ)       /* if (r[a] != 0) pc = c */                            \
+    X(JLt)         /* if (r[a] < r[b]) pc = c */                          \
+    X(JLe)         /* if (r[a] <= r[b]) pc = c */                         \
+    X(JGt)         /* if (r[a] > r[b]) pc = c */                          \
+    X(JGe)         /* if (r[a] >= r[b]) pc = c */                         \
+    X(JEq)         /* if (r[a] == r[b]) pc = c */                         \
+    X(JNe)         /* if (r[a] != r[b]) pc = c */                         \
+    X(Load)        /* r[a] = *r[b] of c bytes, checked on the heap */     \
+    X(Store)       /* *r[a] = r[b] of c bytes, checked on the heap */     \
+    X(LoadElem)    /* r[a] = r[b][r[c]], 8 byte elements */               \
+    X(StoreElem)   /* r[a][r[b]] = r[c], 8 byte elements */               \
+    X(LoadElemInt) /* r[a] = r[b][r[c]], 4 byte elements */               \
+    X(StoreElemInt) /* r[a][r[b]] = r[c], 4 byte elements */             \
+    X(LoadElemChar) /* r[a] = r[b][r[c]], 1 byte elements */             \
+    X(StoreElemChar) /* r[a][r[b]] = r[c], 1 byte elements */            \
+    X(NewArray)    /* r[a] = zero filled array of c bytes, never freed */ \
+    X(FrameArray)  /* r[a] = b zero bytes at c of the frame arrays */     \
+    X(Call)        /* r[a] = functions[b](r[c], r[c + 1], ...) */         \
+    X(TailCall)    /* return functions[b](r[c], ...) in this frame */     \
+    X(Ret)         /* return r[a] */                                      \
+    X(RetVoid)     /* return 0 */                                         \
+    X(Get)         /* r[a] = GET() */                                     \
+    X(Print)       /* PRINT(r[a]) */                                      \
+    X(Malloc)      /* r[a] = MALLOC(r[b]) */                              \
+    X(Free)        /* FREE(r[a]) */                                       \
+    X(Halt)        /* stop the machine */
+
+enum Opcode : unsigned char {
+#define BYTECODE_ENUM(name) OP_##name,
+    BYTECODE_OPCODES(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+        OP_COUNT
+};
+
+inline const char *opcodeName(Opcode op) {
+    static const char *const names[] = {
+#define BYTECODE_NAME(name) #name,
+        BYTECODE_OPCODES(BYTECODE_NAME)
+#undef BYTECODE_NAME
+    };
+    return op < OP_COUNT ? names[op] : "<invalid>";
+}
+
+/// A single fixed width instruction. Immediates that do not fit into c live
+/// in Program::constants.
+struct Instr {
+    Opcode op;
+    int a;
+    int b;
+    int c;
+};
+
+/// A lowered guest function. Parameters occupy the first registers of the
+/// frame, followed by the locals and the expression temporaries.
+struct Function {
+    std::string name;
+    unsigned numParams = 0;
+    unsigned numRegs = 0;
+    /// Bytes of the local arrays, pushed on the arena of the VM when the
+    /// first of them is declared and popped on return
+    unsigned arrayBytes = 0;
+    /// Only touches its own registers and calls pure functions, so its
+    /// result may be cached
+    bool pure = false;
+    std::vector<Instr> code;
+};
+
+/// A whole lowered translation unit.
+struct Program {
+    std::vector<Function> functions;
+    std::vector<long> constants;
+    unsigned numGlobals = 0;
+    /// Index of the synthetic function initializing the globals
+    int init = -1;
+    /// Index of main
+    int entry = -1;
+
+    int findFunction(const std::string &name) const {
+        for (unsigned i = 0; i < functions.size(); i++)
+            if (functions[i].name == name) return i;
+        return -1;
+    }
+};
+
+#endif
@@ -0,0 +1,647 @@
+//==--- BytecodeCompiler.h - Lowers the Clang AST to VM bytecode ----------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_BYTECODE_COMPILER_H
+#define AST_INTERPRETER_BYTECODE_COMPILER_H
+
+#include "Bytecode.h"
+#include "ConstantFolder.h"
+#include "FrameArena.h"
+#include "TypeLayout.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace clang;
+
+/// Lowers every function body of a translation unit into a Program. Locals
+/// and parameters are resolved to fixed registers and globals to fixed slots
+/// of the global segment, so the VM never looks at the AST again.
+class BytecodeCompiler {
+    enum Builtin { BI_None, BI_Free, BI_Malloc, BI_Input, BI_Output };
+
+    Program &mProgram;
+    bool mFailed = false;
+
+    llvm::DenseMap<const FunctionDecl *, unsigned> mFunctions;
+    llvm::DenseMap<const FunctionDecl *, Builtin> mBuiltins;
+    llvm::DenseMap<const VarDecl *, unsigned> mGlobals;
+
+    /// State of the function being lowered
+    Function *mFn = NULL;
+    llvm::DenseMap<const VarDecl *, unsigned> mLocals;
+    unsigned mNextReg = 0;   /// first free register
+    unsigned mFirstTemp = 0; /// registers below hold locals
+    /// Returns may reuse the frame for a tail call; not when the frame has
+    /// local arrays the callee may point into
+    bool mTailCalls = true;
+    /// Pending break / continue jumps of the enclosing loops
+    llvm::SmallVector<llvm::SmallVector<unsigned, 4>, 4> mBreaks;
+    llvm::SmallVector<llvm::SmallVector<unsigned, 4>, 4> mContinues;
+
+   public:
+    explicit BytecodeCompiler(Program &program) : mProgram(program) {}
+
+    /// Lower the whole unit. Returns false if it uses a construct the VM
+    /// cannot run, in which case the caller should fall back to the walker.
+    bool compile(TranslationUnitDecl *unit) {
+        llvm::SmallVector<FunctionDecl *, 16> bodies;
+        llvm::SmallVector<VarDecl *, 16> globals;
+        for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                                e = unit->decls_end();
+             i != e; ++i) {
+            if (VarDecl *vdecl = dyn_cast<VarDecl>(*i)) {
+                mGlobals[vdecl] = mProgram.numGlobals++;
+                globals.push_back(vdecl);
+            }
+            if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
+                const FunctionDecl *canon = fdecl->getCanonicalDecl();
+                if (fdecl->getName().equals("FREE"))
+                    mBuiltins[canon] = BI_Free;
+                else if (fdecl->getName().equals("MALLOC"))
+                    mBuiltins[canon] = BI_Malloc;
+                else if (fdecl->getName().equals("GET"))
+                    mBuiltins[canon] = BI_Input;
+                else if (fdecl->getName().equals("PRINT"))
+                    mBuiltins[canon] = BI_Output;
+                else if (fdecl->doesThisDeclarationHaveABody()) {
+                    mFunctions[canon] = mProgram.functions.size();
+                    mProgram.functions.push_back(Function());
+                    mProgram.functions.back().name = fdecl->getNameAsString();
+                    bodies.push_back(fdecl);
+                }
+            }
+        }
+
+        mProgram.init = mProgram.functions.size();
+        mProgram.functions.push_back(Function());
+        mProgram.functions.back().name = "__init";
+        beginFunction(mProgram.init, 0);
+        for (unsigned i = 0; i < globals.size(); i++) {
+            unsigned reg = newTemp();
+            initVar(globals[i], reg);
+            emit(OP_StoreGlobal, reg, 0, mGlobals[globals[i]]);
+            mNextReg = mFirstTemp;
+        }
+        emit(OP_RetVoid);
+        endFunction();
+
+        for (unsigned i = 0; i < bodies.size(); i++) {
+            FunctionDecl *fdecl = bodies[i];
+            beginFunction(mFunctions[fdecl->getCanonicalDecl()],
+                          fdecl->getNumParams());
+            mTailCalls = !declaresArray(fdecl->getBody());
+            for (unsigned p = 0; p < fdecl->getNumParams(); p++)
+                mLocals[fdecl->getParamDecl(p)] = p;
+            stmt(fdecl->getBody());
+            emit(OP_RetVoid);
+            endFunction();
+            if (fdecl->getName().equals("main"))
+                mProgram.entry = mFunctions[fdecl->getCanonicalDecl()];
+        }
+        if (mProgram.entry < 0) unsupported("missing main", NULL);
+        markPure();
+        return !mFailed;
+    }
+
+   private:
+    /// Every function starts out pure; functions with an impure instruction,
+    /// including calls of impure functions, are dropped until nothing
+    /// changes, so recursive functions can stay pure.
+    void markPure() {
+        for (unsigned i = 0; i < mProgram.functions.size(); i++)
+            mProgram.functions[i].pure = true;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (unsigned i = 0; i < mProgram.functions.size(); i++) {
+                Function &fn = mProgram.functions[i];
+                if (!fn.pure) continue;
+                for (unsigned pc = 0; pc < fn.code.size(); pc++) {
+                    if (!isPure(fn.code[pc])) {
+                        fn.pure = false;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    bool isPure(const Instr &ins) {
+        switch (ins.op) {
+            case OP_LoadGlobal:
+            case OP_StoreGlobal:
+            case OP_Load:
+            case OP_Store:
+            case OP_LoadElem:
+            case OP_StoreElem:
+            case OP_LoadElemInt:
+            case OP_StoreElemInt:
+            case OP_LoadElemChar:
+            case OP_StoreElemChar:
+            case OP_NewArray:
+            case OP_FrameArray:
+            case OP_Get:
+            case OP_Print:
+            case OP_Malloc:
+            case OP_Free:
+            case OP_Halt:
+                return false;
+            case OP_Call:
+            case OP_TailCall:
+                return mProgram.functions[ins.b].pure;
+            default:
+                return true;
+        }
+    }
+
+    void unsupported(const char *what, Stmt *s) {
+        if (!mFailed) {
+            llvm::errs() << "VM: unsupported " << what;
+            if (s) llvm::errs() << " (" << s->getStmtClassName() << ")";
+            llvm::errs() << ", falling back to the AST walker.\n";
+        }
+        mFailed = true;
+    }
+
+    void beginFunction(unsigned index, unsigned numParams) {
+        mFn = &mProgram.functions[index];
+        mFn->numParams = numParams;
+        mLocals.clear();
+        mNextReg = mFirstTemp = numParams;
+        mFn->numRegs = numParams;
+    }
+
+    void endFunction() { mFn = NULL; }
+
+    unsigned emit(Opcode op, int a = 0, int b = 0, int c = 0) {
+        Instr ins = {op, a, b, c};
+        mFn->code.push_back(ins);
+        return mFn->code.size() - 1;
+    }
+
+    unsigned here() { return mFn->code.size(); }
+    void patch(unsigned at, unsigned target) { mFn->code[at].c = target; }
+
+    unsigned newTemp() {
+        unsigned reg = mNextReg++;
+        if (mNextReg > mFn->numRegs) mFn->numRegs = mNextReg;
+        return reg;
+    }
+
+    unsigned newLocal(const VarDecl *vdecl) {
+        // locals are only declared at statement boundaries, where no
+        // temporary is live
+        unsigned reg = newTemp();
+        mFirstTemp = mNextReg;
+        mLocals[vdecl] = reg;
+        return reg;
+    }
+
+    void loadImm(unsigned reg, long value) {
+        if (value == (long)(int)value) {
+            emit(OP_LoadImm, reg, 0, (int)value);
+        } else {
+            emit(OP_LoadConst, reg, 0, mProgram.constants.size());
+            mProgram.constants.push_back(value);
+        }
+    }
+
+    /// Initialize a freshly declared variable living in reg
+    void initVar(VarDecl *vdecl, unsigned reg) {
+        const Type *type = vdecl->getType().getTypePtr();
+        if (type->isArrayType()) {
+            const ConstantArrayType *atype = dyn_cast<ConstantArrayType>(type);
+            if (!atype) return unsupported("array type", NULL);
+            int asize = atype->getSize().getSExtValue();
+            if (asize <= 0) {
+                llvm::errs() << "Error: Invalid Array Size " << asize << ".\n";
+            }
+            long bytes = TypeLayout::sizeOf(vdecl->getType());
+            if (vdecl->hasGlobalStorage()) {
+                emit(OP_NewArray, reg, 0, bytes);
+            } else {
+                // every array of the frame has storage of its own, reused
+                // each time its declaration runs again
+                emit(OP_FrameArray, reg, bytes, mFn->arrayBytes);
+                mFn->arrayBytes += FrameArena::align(bytes);
+            }
+        } else if (vdecl->hasInit()) {
+            expr(vdecl->getInit(), reg);
+        } else {
+            emit(OP_LoadImm, reg, 0, 0);
+        }
+    }
+
+    //===------------------------------------------------------------------===//
+    // Statements
+    //===------------------------------------------------------------------===//
+
+    void stmt(Stmt *s) {
+        mNextReg = mFirstTemp;
+        if (!s) return;
+        if (Expr *e = dyn_cast<Expr>(s)) {
+            expr(e);
+        } else if (CompoundStmt *cs = dyn_cast<CompoundStmt>(s)) {
+            for (CompoundStmt::body_iterator i = cs->body_begin(),
+                                             e = cs->body_end();
+                 i != e; ++i)
+                stmt(*i);
+        } else if (DeclStmt *ds = dyn_cast<DeclStmt>(s)) {
+            for (DeclStmt::decl_iterator i = ds->decl_begin(),
+                                         e = ds->decl_end();
+                 i != e; ++i) {
+                if (VarDecl *vdecl = dyn_cast<VarDecl>(*i)) {
+                    initVar(vdecl, newLocal(vdecl));
+                    mNextReg = mFirstTemp;
+                }
+            }
+        } else if (IfStmt *is = dyn_cast<IfStmt>(s)) {
+            Stmt *taken;
+            if (ConstantFolder::prune(is, taken)) {
+                stmt(taken);
+                return;
+            }
+            unsigned toElse = branch(is->getCond(), false);
+            stmt(is->getThen());
+            if (is->getElse()) {
+                unsigned toEnd = emit(OP_Jmp);
+                patch(toElse, here());
+                stmt(is->getElse());
+                patch(toEnd, here());
+            } else {
+                patch(toElse, here());
+            }
+        } else if (WhileStmt *ws = dyn_cast<WhileStmt>(s)) {
+            unsigned top = here();
+            unsigned toEnd = branch(ws->getCond(), false);
+            loop(ws->getBody());
+            emit(OP_Jmp, 0, 0, top);
+            patch(toEnd, here());
+            endLoop(here(), top);
+        } else if (ForStmt *fs = dyn_cast<ForStmt>(s)) {
+            stmt(fs->getInit());
+            unsigned top = here();
+            int toEnd = fs->getCond() ? (int)branch(fs->getCond(), false) : -1;
+            loop(fs->getBody());
+            unsigned next = here();
+            stmt(fs->getInc());
+            emit(OP_Jmp, 0, 0, top);
+            if (toEnd >= 0) patch(toEnd, here());
+            endLoop(here(), next);
+        } else if (ReturnStmt *rs = dyn_cast<ReturnStmt>(s)) {
+            Expr *rexpr = rs->getRetValue();
+            if (tailcall(rexpr))
+                ;
+            else if (rexpr)
+                emit(OP_Ret, expr(rexpr));
+            else
+                emit(OP_RetVoid);
+        } else if (isa<BreakStmt>(s) || isa<ContinueStmt>(s)) {
+            if (mBreaks.empty()) return unsupported("jump outside loop", s);
+            unsigned at = emit(OP_Jmp);
+            if (isa<BreakStmt>(s))
+                mBreaks.back().push_back(at);
+            else
+                mContinues.back().push_back(at);
+        } else if (!isa<NullStmt>(s)) {
+            unsupported("statement", s);
+        }
+        mNextReg = mFirstTemp;
+    }
+
+    /// Lower `return f(...)` of a guest function to a call reusing the frame
+    bool tailcall(Expr *rexpr) {
+        if (!rexpr || !mTailCalls) return false;
+        CallExpr *call = dyn_cast<CallExpr>(rexpr->IgnoreParenImpCasts());
+        if (!call || !call->getDirectCallee()) return false;
+        llvm::DenseMap<const FunctionDecl *, unsigned>::iterator fn =
+            mFunctions.find(call->getDirectCallee()->getCanonicalDecl());
+        if (fn == mFunctions.end()) return false;
+        unsigned args = mNextReg;
+        for (unsigned i = 0; i < call->getNumArgs(); i++) newTemp();
+        for (unsigned i = 0; i < call->getNumArgs(); i++) {
+            unsigned saved = mNextReg;
+            expr(call->getArg(i), args + i);
+            mNextReg = saved;
+        }
+        emit(OP_TailCall, 0, fn->second, args);
+        return true;
+    }
+
+    static bool declaresArray(Stmt *s) {
+        if (!s) return false;
+        if (DeclStmt *ds = dyn_cast<DeclStmt>(s))
+            for (DeclStmt::decl_iterator i = ds->decl_begin(),
+                                         e = ds->decl_end();
+                 i != e; ++i)
+                if (VarDecl *vdecl = dyn_cast<VarDecl>(*i))
+                    if (vdecl->getType()->isArrayType()) return true;
+        for (Stmt *child : s->children())
+            if (declaresArray(child)) return true;
+        return false;
+    }
+
+    void loop(Stmt *body) {
+        mBreaks.push_back(llvm::SmallVector<unsigned, 4>());
+        mContinues.push_back(llvm::SmallVector<unsigned, 4>());
+        stmt(body);
+    }
+
+    void endLoop(unsigned breakTarget, unsigned continueTarget) {
+        for (unsigned i = 0; i < mBreaks.back().size(); i++)
+            patch(mBreaks.back()[i], breakTarget);
+        for (unsigned i = 0; i < mContinues.back().size(); i++)
+            patch(mContinues.back()[i], continueTarget);
+        mBreaks.pop_back();
+        mContinues.pop_back();
+    }
+
+    /// Emit a conditional jump taken when cond evaluates to `when`. Returns
+    /// the instruction whose target still has to be patched.
+    unsigned branch(Expr *cond, bool when) {
+        long value;
+        if (ConstantFolder::fold(cond, value))
+            return emit((value != 0) == when ? OP_Jmp : OP_Nop);
+        Expr *e = cond->IgnoreParenImpCasts();
+        if (BinaryOperator *bop = dyn_cast<BinaryOperator>(e)) {
+            if (bop->isComparisonOp()) {
+                int l = expr(bop->getLHS());
+                int r = expr(bop->getRHS());
+                BinaryOperatorKind kind = bop->getOpcode();
+                if (!when) kind = BinaryOperator::negateComparisonOp(kind);
+                return emit(jumpFor(kind), l, r);
+            }
+        }
+        return emit(when ? OP_JmpNZ : OP_JmpZ, expr(cond));
+    }
+
+    static Opcode jumpFor(BinaryOperatorKind kind) {
+        switch (kind) {
+            case BO_LT:
+                return OP_JLt;
+            case BO_LE:
+                return OP_JLe;
+            case BO_GT:
+                return OP_JGt;
+            case BO_GE:
+                return OP_JGe;
+            case BO_EQ:
+                return OP_JEq;
+            default:
+                return OP_JNe;
+        }
+    }
+
+    //===------------------------------------------------------------------===//
+    // Expressions
+    //===------------------------------------------------------------------===//
+
+    /// Lower e and return the register holding its value. If dst is not
+    /// negative the value is produced in dst.
+    int expr(Expr *e, int dst = -1) {
+        long value;
+        if (ConstantFolder::fold(e, value)) {
+            // literals, sizeof and arithmetic on them
+            int reg = target(dst);
+            loadImm(reg, value);
+            return reg;
+        } else if (ParenExpr *pe = dyn_cast<ParenExpr>(e)) {
+            return expr(pe->getSubExpr(), dst);
+        } else if (CastExpr *ce = dyn_cast<CastExpr>(e)) {
+            return expr(ce->getSubExpr(), dst);
+        } else if (UnaryExprOrTypeTraitExpr *tte =
+                       dyn_cast<UnaryExprOrTypeTraitExpr>(e)) {
+            unsupported("type trait", tte);
+            return target(dst);
+        } else if (DeclRefExpr *dref = dyn_cast<DeclRefExpr>(e)) {
+            return declref(dref, dst);
+        } else if (BinaryOperator *bop = dyn_cast<BinaryOperator>(e)) {
+            return binop(bop, dst);
+        } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(e)) {
+            return unaryop(uop, dst);
+        } else if (ArraySubscriptExpr *ae = dyn_cast<ArraySubscriptExpr>(e)) {
+            int base = expr(ae->getBase());
+            int index = expr(ae->getIdx());
+            int reg = target(dst);
+            emit(elementOp(ae, false), reg, base, index);
+            return reg;
+        } else if (CallExpr *call = dyn_cast<CallExpr>(e)) {
+            return callexpr(call, dst);
+        }
+        unsupported("expression", e);
+        return target(dst);
+    }
+
+    int target(int dst) { return dst >= 0 ? dst : (int)newTemp(); }
+
+    /// The load or store of the elements of ae, by their size
+    Opcode elementOp(ArraySubscriptExpr *ae, bool store) {
+        switch (TypeLayout::sizeOf(ae->getType())) {
+            case 1:
+                return store ? OP_StoreElemChar : OP_LoadElemChar;
+            case 4:
+                return store ? OP_StoreElemInt : OP_LoadElemInt;
+            case 8:
+                return store ? OP_StoreElem : OP_LoadElem;
+            default:
+                unsupported("element type", ae);
+                return OP_Nop;
+        }
+    }
+
+    int declref(DeclRefExpr *dref, int dst) {
+        const VarDecl *vdecl = dyn_cast<VarDecl>(dref->getDecl());
+        if (!vdecl) {
+            unsupported("reference", dref);
+            return target(dst);
+        }
+        llvm::DenseMap<const VarDecl *, unsigned>::iterator local =
+            mLocals.find(vdecl);
+        if (local != mLocals.end()) {
+            if (dst < 0 || dst == (int)local->second) return local->second;
+            emit(OP_Mov, dst, local->second);
+            return dst;
+        }
+        llvm::DenseMap<const VarDecl *, unsigned>::iterator global =
+            mGlobals.find(vdecl);
+        if (global == mGlobals.end()) {
+            unsupported("variable", dref);
+            return target(dst);
+        }
+        int reg = target(dst);
+        emit(OP_LoadGlobal, reg, 0, global->second);
+        return reg;
+    }
+
+    int unaryop(UnaryOperator *uop, int dst) {
+        switch (uop->getOpcode()) {
+            case UO_Plus:
+                return expr(uop->getSubExpr(), dst);
+            case UO_Minus: {
+                int sub = expr(uop->getSubExpr());
+                int reg = target(dst);
+                emit(OP_Neg, reg, sub);
+                return reg;
+            }
+            case UO_Deref: {
+                int addr = expr(uop->getSubExpr());
+                int reg = target(dst);
+                emit(OP_Load, reg, addr,
+                     TypeLayout::sizeOf(uop->getType()));
+                return reg;
+            }
+            default:
+                unsupported("unary operator", uop);
+                return target(dst);
+        }
+    }
+
+    int binop(BinaryOperator *bop, int dst) {
+        if (bop->getOpcode() == BO_Assign) return assign(bop, dst);
+        Expr *left = bop->getLHS();
+        Expr *right = bop->getRHS();
+        Opcode op;
+        switch (bop->getOpcode()) {
+            case BO_Add:
+                op = OP_Add;
+                break;
+            case BO_Sub:
+                op = OP_Sub;
+                break;
+            case BO_Mul:
+                op = OP_Mul;
+                break;
+            case BO_Div:
+                op = OP_Div;
+                break;
+            case BO_Rem:
+                op = OP_Rem;
+                break;
+            case BO_LT:
+                op = OP_Lt;
+                break;
+            case BO_LE:
+                op = OP_Le;
+                break;
+            case BO_GT:
+                op = OP_Gt;
+                break;
+            case BO_GE:
+                op = OP_Ge;
+                break;
+            case BO_EQ:
+                op = OP_Eq;
+                break;
+            case BO_NE:
+                op = OP_Ne;
+                break;
+            default:
+                unsupported("binary operator", bop);
+                return target(dst);
+        }
+        int l = expr(left);
+        int r = expr(right);
+        // pointer arithmetic moves in units of the pointee
+        long stride = TypeLayout::stride(left->getType());
+        if (stride > 1 && bop->isAdditiveOp() &&
+            !right->getType()->isPointerType()) {
+            int scaled = newTemp();
+            emit(OP_MulImm, scaled, r, stride);
+            r = scaled;
+        }
+        int reg = target(dst);
+        emit(op, reg, l, r);
+        return reg;
+    }
+
+    int assign(BinaryOperator *bop, int dst) {
+        Expr *left = bop->getLHS()->IgnoreParens();
+        if (DeclRefExpr *dref = dyn_cast<DeclRefExpr>(left)) {
+            const VarDecl *vdecl = dyn_cast<VarDecl>(dref->getDecl());
+            llvm::DenseMap<const VarDecl *, unsigned>::iterator local =
+                mLocals.find(vdecl);
+            if (local != mLocals.end()) {
+                int reg = expr(bop->getRHS(), local->second);
+                if (dst >= 0 && dst != reg) emit(OP_Mov, dst, reg);
+                return dst >= 0 ? dst : reg;
+            }
+            llvm::DenseMap<const VarDecl *, unsigned>::iterator global =
+                mGlobals.find(vdecl);
+            if (global == mGlobals.end()) {
+                unsupported("assignment target", dref);
+                return target(dst);
+            }
+            int val = expr(bop->getRHS(), dst);
+            emit(OP_StoreGlobal, val, 0, global->second);
+            return val;
+        }
+        int val = expr(bop->getRHS(), dst);
+        if (ArraySubscriptExpr *ae = dyn_cast<ArraySubscriptExpr>(left)) {
+            int index = expr(ae->getIdx());
+            int base = expr(ae->getBase());
+            emit(elementOp(ae, true), base, index, val);
+        } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(left)) {
+            if (uop->getOpcode() != UO_Deref)
+                unsupported("assignment target", uop);
+            int addr = expr(uop->getSubExpr());
+            emit(OP_Store, addr, val, TypeLayout::sizeOf(uop->getType()));
+        } else {
+            unsupported("assignment target", left);
+        }
+        return val;
+    }
+
+    int callexpr(CallExpr *call, int dst) {
+        FunctionDecl *callee = call->getDirectCallee();
+        if (!callee) {
+            unsupported("indirect call", call);
+            return target(dst);
+        }
+        const FunctionDecl *canon = callee->getCanonicalDecl();
+        llvm::DenseMap<const FunctionDecl *, Builtin>::iterator builtin =
+            mBuiltins.find(canon);
+        if (builtin != mBuiltins.end()) {
+            int reg = target(dst);
+            switch (builtin->second) {
+                case BI_Input:
+                    emit(OP_Get, reg);
+                    break;
+                case BI_Output:
+                    emit(OP_Print, expr(call->getArg(0)));
+                    break;
+                case BI_Malloc:
+                    emit(OP_Malloc, reg, expr(call->getArg(0)));
+                    break;
+                case BI_Free:
+                    emit(OP_Free, expr(call->getArg(0)));
+                    break;
+                default:
+                    break;
+            }
+            return reg;
+        }
+        llvm::DenseMap<const FunctionDecl *, unsigned>::iterator fn =
+            mFunctions.find(canon);
+        if (fn == mFunctions.end()) {
+            unsupported("call to undefined function", call);
+            return target(dst);
+        }
+        int reg = target(dst);
+        // arguments go to the top of the frame, where the callee frame will
+        // start, so they become its parameters without being copied
+        unsigned args = mNextReg;
+        for (unsigned i = 0; i < call->getNumArgs(); i++) newTemp();
+        for (unsigned i = 0; i < call->getNumArgs(); i++) {
+            unsigned saved = mNextReg;
+            expr(call->getArg(i), args + i);
+            mNextReg = saved;
+        }
+        emit(OP_Call, reg, fn->second, args);
+        return reg;
+    }
+};
+
+#endif
@@ -0,0 +1,111 @@
+//==--- ConstantFolder.h - Load time evaluation of constant expressions ---===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_CONSTANT_FOLDER_H
+#define AST_INTERPRETER_CONSTANT_FOLDER_H
+
+#include <limits.h>
+
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "TypeLayout.h"
+
+using namespace clang;
+
+/// Evaluates expressions built from literals and sizeof exactly as both
+/// engines would at run time, so their value can be computed once when a
+/// function is loaded. Operations that would fault (division or remainder
+/// by zero, or of LONG_MIN by -1) are left alone.
+class ConstantFolder {
+   public:
+    /// Returns true and sets value if e always evaluates to the same value
+    static bool fold(const Expr *e, long &value) {
+        if (const IntegerLiteral *il = dyn_cast<IntegerLiteral>(e)) {
+            value = (long)il->getValue().getLimitedValue();
+            return true;
+        } else if (const CharacterLiteral *cl = dyn_cast<CharacterLiteral>(e)) {
+            value = (long)cl->getValue();
+            return true;
+        } else if (const UnaryExprOrTypeTraitExpr *tte =
+                       dyn_cast<UnaryExprOrTypeTraitExpr>(e)) {
+            if (tte->getKind() != UETT_SizeOf) return false;
+            value = TypeLayout::sizeOf(tte->getTypeOfArgument());
+            return true;
+        } else if (const ParenExpr *pe = dyn_cast<ParenExpr>(e)) {
+            return fold(pe->getSubExpr(), value);
+        } else if (const CastExpr *ce = dyn_cast<CastExpr>(e)) {
+            return fold(ce->getSubExpr(), value);
+        } else if (const UnaryOperator *uop = dyn_cast<UnaryOperator>(e)) {
+            if (uop->getOpcode() != UO_Plus && uop->getOpcode() != UO_Minus)
+                return false;
+            if (!fold(uop->getSubExpr(), value)) return false;
+            if (uop->getOpcode() == UO_Minus) value = -value;
+            return true;
+        } else if (const BinaryOperator *bop = dyn_cast<BinaryOperator>(e)) {
+            long vall, valr;
+            if (!fold(bop->getLHS(), vall) || !fold(bop->getRHS(), valr))
+                return false;
+            long stride = TypeLayout::stride(bop->getLHS()->getType());
+            if (stride && bop->isAdditiveOp() &&
+                !bop->getRHS()->getType()->isPointerType())
+                valr *= stride;
+            return binop(bop->getOpcode(), vall, valr, value);
+        }
+        return false;
+    }
+
+    /// Returns true if the condition of ifstmt is constant and sets taken to
+    /// the branch that always runs, NULL if there is none
+    static bool prune(const IfStmt *ifstmt, Stmt *&taken) {
+        long cond;
+        if (!fold(ifstmt->getCond(), cond)) return false;
+        taken = cond != 0 ? const_cast<Stmt *>(ifstmt->getThen())
+                          : const_cast<Stmt *>(ifstmt->getElse());
+        return true;
+    }
+
+   private:
+    static bool binop(BinaryOperatorKind op, long vall, long valr,
+                      long &value) {
+        switch (op) {
+            case BO_Add:
+                value = vall + valr;
+                return true;
+            case BO_Sub:
+                value = vall - valr;
+                return true;
+            case BO_Mul:
+                value = vall * valr;
+                return true;
+            case BO_Div:
+                if (valr == 0 || (valr == -1 && vall == LONG_MIN)) return false;
+                value = vall / valr;
+                return true;
+            case BO_Rem:
+                if (valr == 0 || (valr == -1 && vall == LONG_MIN)) return false;
+                value = vall % valr;
+                return true;
+            case BO_GT:
+                value = vall > valr;
+                return true;
+            case BO_LT:
+                value = vall < valr;
+                return true;
+            case BO_EQ:
+                value = vall == valr;
+                return true;
+            case BO_GE:
+                value = vall >= valr;
+                return true;
+            case BO_LE:
+                value = vall <= valr;
+                return true;
+            case BO_NE:
+                value = vall != valr;
+                return true;
+            default:
+                return false;
+        }
+    }
+};
+
+#endif
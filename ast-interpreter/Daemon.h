@@ -0,0 +1,225 @@
+//==--- Daemon.h - Long lived server running programs sent over a socket --===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_DAEMON_H
+#define AST_INTERPRETER_DAEMON_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+/// Serves programs on a Unix domain socket. A connection carries one request:
+/// a line holding the length of the source, the source, then the input read
+/// by GET until the client shuts down its side. The GET prompts and PRINT
+/// output are streamed back as they are written and the connection closes
+/// when the program ends. Every connection is served by its own thread.
+///
+/// A request is prepared in the daemon, where what it parses stays for the
+/// next one, and run in a worker process forked for it. A guest that faults
+/// (SIGFPE, a stack overflow, a crash in compiled code) only ends its own
+/// worker; the client is told which signal killed it. Preparing and forking
+/// hold one lock, so a worker never inherits a lock held inside Clang or
+/// LLVM by another thread.
+class Daemon {
+    /// Longest source accepted, anything larger is a malformed request
+    static const unsigned long kMaxSource = 16 << 20;
+
+   public:
+    /// Runs a prepared request in the worker, reading the input of GET from
+    /// in and writing to out
+    typedef std::function<void(FILE *in, FILE *out)> Worker;
+    /// Prepares source in the daemon. Returns an empty Worker after writing
+    /// the error to out if it cannot be run.
+    typedef std::function<Worker(const std::string &source, FILE *out)>
+        Handler;
+
+    /// Accept connections on path until accept fails. Returns the exit
+    /// status.
+    static int serve(const std::string &path, const Handler &handler) {
+        signal(SIGPIPE, SIG_IGN);  // clients may hang up early
+        sockaddr_un addr;
+        int fd = socketFor(path, addr);
+        if (fd < 0) return 1;
+        unlink(path.c_str());  // left behind by an earlier daemon
+        if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(fd, SOMAXCONN) != 0) {
+            perror(path.c_str());
+            close(fd);
+            return 1;
+        }
+        for (;;) {
+            int conn = accept(fd, NULL, NULL);
+            if (conn < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                perror("accept");
+                break;
+            }
+            std::thread(connection, conn, handler).detach();
+        }
+        close(fd);
+        return 1;
+    }
+
+    /// Run source on the daemon at path, forwarding standard input and
+    /// copying what comes back to standard error. Returns the exit status.
+    static int request(const std::string &path, llvm::StringRef source) {
+        sockaddr_un addr;
+        int fd = socketFor(path, addr);
+        if (fd < 0) return 1;
+        std::string header = std::to_string(source.size()) + "\n";
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+            !writeAll(fd, header.data(), header.size()) ||
+            !writeAll(fd, source.data(), source.size())) {
+            perror(path.c_str());
+            close(fd);
+            return 1;
+        }
+        pollfd fds[2] = {{fd, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        bool inputOpen = true;
+        char buf[4096];
+        for (;;) {
+            if (poll(fds, inputOpen ? 2 : 1, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[0].revents) {
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if (n <= 0) break;
+                writeAll(STDERR_FILENO, buf, n);
+            }
+            if (inputOpen && fds[1].revents) {
+                ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+                if (n <= 0 || !writeAll(fd, buf, n)) {
+                    shutdown(fd, SHUT_WR);
+                    inputOpen = false;
+                }
+            }
+        }
+        close(fd);
+        return 0;
+    }
+
+   private:
+    static int socketFor(const std::string &path, sockaddr_un &addr) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "%s: socket path too long\n", path.c_str());
+            return -1;
+        }
+        strcpy(addr.sun_path, path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) perror("socket");
+        return fd;
+    }
+
+    static bool writeAll(int fd, const char *data, size_t size) {
+        while (size) {
+            ssize_t n = write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    /// Serve one request. Output is line buffered so every PRINT reaches
+    /// the client as it happens.
+    static void connection(int conn, Handler handler) {
+        FILE *in = fdopen(conn, "r");
+        if (!in) {
+            close(conn);
+            return;
+        }
+        FILE *out = fdopen(dup(conn), "w");
+        if (!out) {
+            fclose(in);
+            return;
+        }
+        setvbuf(out, NULL, _IOLBF, 0);
+        unsigned long length;
+        std::string source;
+        if (fscanf(in, "%lu", &length) == 1 && fgetc(in) == '\n' &&
+            length <= kMaxSource) {
+            source.resize(length);
+            if (fread(&source[0], 1, length, in) == length)
+                run(source, handler, in, out);
+            else
+                fputs("error: truncated request\n", out);
+        } else {
+            fputs("error: malformed request\n", out);
+        }
+        fclose(out);
+        fclose(in);
+    }
+
+    static std::mutex &forkLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    /// Prepare source and run it in a worker, waiting for it to end
+    static void run(const std::string &source, const Handler &handler,
+                    FILE *in, FILE *out) {
+        pid_t pid;
+        {
+            std::lock_guard<std::mutex> guard(forkLock());
+            Worker worker = handler(source, out);
+            if (!worker) return;
+            fflush(out);
+            pid = fork();
+            if (pid == 0) {
+                closeOthers(fileno(in), fileno(out));
+                worker(in, out);
+                fflush(out);
+                _exit(0);
+            }
+        }
+        if (pid < 0) {
+            perror("fork");
+            fputs("error: cannot start a worker\n", out);
+            return;
+        }
+        int status;
+        while (waitpid(pid, &status, 0) < 0)
+            if (errno != EINTR) return;
+        if (WIFSIGNALED(status))
+            fprintf(out, "error: the program was killed by signal %d (%s)\n",
+                    WTERMSIG(status), strsignal(WTERMSIG(status)));
+    }
+
+    /// Close the descriptors a worker inherits besides its connection and
+    /// the standard streams: the listening socket and the connections of
+    /// other requests, which would otherwise stay open until it ends
+    static void closeOthers(int in, int out) {
+        DIR *dir = opendir("/proc/self/fd");
+        if (!dir) return;
+        std::vector<int> fds;
+        while (dirent *entry = readdir(dir)) {
+            int fd = atoi(entry->d_name);
+            if (fd > STDERR_FILENO && fd != in && fd != out &&
+                fd != dirfd(dir))
+                fds.push_back(fd);
+        }
+        closedir(dir);
+        for (unsigned i = 0; i < fds.size(); i++) close(fds[i]);
+    }
+};
+
+#endif
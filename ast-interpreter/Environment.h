@@ -1,111 +1,240 @@
 //==--- tools/clang-check/ClangInterpreter.cpp - Clang Interpreter tool
 //--------------===//
 //===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_ENVIRONMENT_H
+#define AST_INTERPRETER_ENVIRONMENT_H
+
+#include <limits.h>
 #include <stdio.h>
 
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/Decl.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
+#include "ConstantFolder.h"
+#include "FrameArena.h"
+#include "GuestIO.h"
+#include "GuestMemory.h"
+#include "Heap.h"
+#include "MemoCache.h"
+#include "Snapshot.h"
+#include "TypeLayout.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/StringMap.h"
 
 using namespace clang;
 
-class StackFrame {
-    /// StackFrame maps Variable Declaration to Value
-    /// Which are either integer or addresses (also represented using an Integer
-    /// value)
-    std::map<Decl *, long> mVars;
-    std::map<Stmt *, long> mExprs;
-    /// The current stmt
-    Stmt *mPC;
-    long retValue = 0;
-    bool returned = false;
+/// Where a variable lives once resolved: a slot of the current frame or of the
+/// global segment
+struct VarSlot {
+    bool global;
+    unsigned index;
+};
 
+/// Where a local array lives: at offset in the block of arrays of its frame,
+/// which holds frameBytes
+struct LocalArray {
+    long offset;
+    long size;
+    long frameBytes;
+};
+
+/// Collects the variables declared in a function body, in declaration order,
+/// and its tail calls: returns whose value is a call of a function with a body
+class BodyScanner : public RecursiveASTVisitor<BodyScanner> {
    public:
-    StackFrame() : mVars(), mExprs(), mPC() {}
-    bool findDecl(Decl *decl) { return mVars.find(decl) != mVars.end(); }
+    std::vector<VarDecl *> mLocals;
+    std::vector<std::pair<ReturnStmt *, CallExpr *> > mTailCalls;
 
-    void bindDecl(Decl *decl, long val) {
-        // llvm::errs() << "binddecl:"<<val<<"\n";
-        mVars[decl] = val;
+    bool VisitVarDecl(VarDecl *vdecl) {
+        mLocals.push_back(vdecl);
+        return true;
     }
 
-    long getDeclVal(Decl *decl) {
-        assert(mVars.find(decl) != mVars.end());
-        return mVars.find(decl)->second;
+    bool VisitReturnStmt(ReturnStmt *rstmt) {
+        Expr *rexpr = rstmt->getRetValue();
+        if (!rexpr) return true;
+        if (CallExpr *call = dyn_cast<CallExpr>(rexpr->IgnoreParenImpCasts())) {
+            FunctionDecl *callee = call->getDirectCallee();
+            if (callee && callee->hasBody())
+                mTailCalls.push_back(std::make_pair(rstmt, call));
+        }
+        return true;
     }
-    void bindStmt(Stmt *stmt, long val) {
-        // llvm::errs() << "bindStmt "<<val<<"\n";
-        mExprs[stmt] = val;
+};
+
+/// Finds out whether a function body may touch anything but its own frame:
+/// globals, memory through a pointer or an array, local arrays or built-in
+/// functions. The guest functions it calls are collected; whether they are
+/// pure is settled once every body has been scanned.
+class PurityScanner : public RecursiveASTVisitor<PurityScanner> {
+   public:
+    bool mImpure = false;
+    std::vector<const FunctionDecl *> mCallees;
+
+    bool VisitDeclRefExpr(DeclRefExpr *dref) {
+        if (VarDecl *vdecl = dyn_cast<VarDecl>(dref->getDecl()))
+            if (vdecl->hasGlobalStorage()) mImpure = true;
+        return !mImpure;
     }
-    long getStmtVal(Stmt *stmt) {
-        // llvm::errs() << "getStmtVal:"<<stmt<<"\n";
-        assert(mExprs.find(stmt) != mExprs.end());
-        return mExprs[stmt];
+
+    bool VisitVarDecl(VarDecl *vdecl) {
+        if (vdecl->hasGlobalStorage() || vdecl->getType()->isArrayType())
+            mImpure = true;
+        return !mImpure;
     }
-    void setPC(Stmt *stmt) { mPC = stmt; }
-    Stmt *getPC() { return mPC; }
 
-    long getRetValue() { return retValue; }
-    void setRetValue(long v) { retValue = v; }
-    void setReturned() { returned = true; }
-    bool isReturned() { return returned; }
+    bool VisitUnaryOperator(UnaryOperator *uop) {
+        if (uop->getOpcode() == UO_Deref) mImpure = true;
+        return !mImpure;
+    }
+
+    bool VisitArraySubscriptExpr(ArraySubscriptExpr *aexpr) {
+        mImpure = true;
+        return false;
+    }
+
+    bool VisitCallExpr(CallExpr *call) {
+        // built-in functions have no body
+        FunctionDecl *callee = call->getDirectCallee();
+        if (callee && callee->hasBody())
+            mCallees.push_back(callee->getCanonicalDecl());
+        else
+            mImpure = true;
+        return !mImpure;
+    }
+};
+
+/// Tiering state of a guest function: how often the walker called it and its
+/// compiled code once the JIT took it over
+struct FunctionCounter {
+    unsigned calls = 0;
+    bool failed = false;  /// cannot be compiled, stays interpreted
+    /// Takes a pointer to the arguments and returns the result
+    long (*native)(const long *args) = NULL;
 };
 
-/// Heap maps address to a value
-class Heap {
-    std::map<long *, int> block;
+/// Tiering state of a loop: iterations run by the walker and its compiled
+/// code, which takes over the frame of the running function
+struct LoopCounter {
+    unsigned iterations = 0;
+    bool failed = false;
+    /// Runs the loop on the frame slots at fp from the evaluation of its
+    /// condition on. Returns 0 if the loop finished and 1 if it returned,
+    /// storing the returned value into *ret.
+    int (*native)(long *fp, long *ret) = NULL;
+};
+
+/// What the walker learned about an expression the first time it ran it, so
+/// later visits dispatch straight to a specialized handler
+struct QuickInfo {
+    enum Handler {
+        Generic,  /// no fast path, use the visitor method
+        Const,    /// value
+        Local,    /// slot value of the current frame
+        Global,   /// slot value of the global segment
+        Pass,     /// value of lhs (parens and casts)
+        Binary,   /// op applied to lhs and rhs
+        Builtin,  /// built-in function value
+        Call      /// guest function callee, memoized if memo is set
+    };
+    enum BuiltinKind { BI_Input, BI_Output, BI_Malloc, BI_Free };
+
+    Handler handler = Generic;
+    BinaryOperatorKind op = BO_Comma;
+    long scale = 0;  /// bytes per unit of rhs when lhs is a pointer
+    long value = 0;
+    Expr *lhs = NULL;
+    Expr *rhs = NULL;
+    FunctionDecl *callee = NULL;
+    Stmt *body = NULL;
+    unsigned frameSize = 0;
+    bool memo = false;
+    FunctionCounter *counter = NULL;  /// of the guest callee
+};
+
+class StackFrame {
+    /// The slots of the frame, one per parameter and local of the function,
+    /// live in the value stack of the Environment starting at mBase. Values
+    /// are either integer or addresses (also represented using an Integer
+    /// value)
+    unsigned mBase;
+    /// The current stmt
+    Stmt *mPC;
+    /// The local arrays of the frame in the arena, NULL until one is
+    /// declared
+    char *mArrays;
+    long retValue = 0;
 
    public:
-    long *Malloc(int size) {
-        long *t = (long *)malloc(size);
-        //printf("malloc %d at 0x%p.\n", size, t);
-        block[t] = size;
-        return t;
-    }
-    void Free(long *addr) {
-        if (block.find(addr) == block.end()) {
-            printf("Error:Free invalid address:0x%p\n", addr);
-        }
-        free(addr);
-        //printf("free 0x%p.\n", addr);
-    }
-    void Update(long *addr, long val) {
-        bool valid = check(addr);
-        if (valid) {
-            *addr = val;
-            //printf("Update 0x%p to %ld.\n", addr, val);
-        } else
-            printf("Error:Update invalid address:0x%p\n", addr);
-    }
-    long Get(long *addr) {
-        bool valid = check(addr);
-        if (valid) {
-            //printf("GET:0x%p,value:%ld.\n", addr, *addr);
-            return *addr;
-        } else {
-            printf("Error:Get value of invalid address:0x%p\n", addr);
-            return -1;
-        }
-    }
-    bool check(long *addr) {
-        bool valid = false;
-        for (std::map<long *, int>::iterator iter = block.begin();
-             iter != block.end(); iter++) {
-            if ((long)(addr) >= (long)(iter->first) &&
-                (long)addr <= (long)(iter->first) + (long)(iter->second)) {
-                valid = true;
-                break;
-            }
-        }
-        return valid;
-    }
+    explicit StackFrame(unsigned base) : mBase(base), mPC(), mArrays() {}
+
+    unsigned getBase() { return mBase; }
+    void setPC(Stmt *stmt) { mPC = stmt; }
+    Stmt *getPC() { return mPC; }
+    char *getArrays() { return mArrays; }
+    void setArrays(char *arrays) { mArrays = arrays; }
+
+    long getRetValue() { return retValue; }
+    void setRetValue(long v) { retValue = v; }
 };
 
 class Environment {
     std::vector<StackFrame> mStack;
+    /// Set while mStack reallocates, when a signal handler must not read it
+    volatile sig_atomic_t mGrowing;
+    /// The value stack holding the slots of every frame back to back, its
+    /// used part and the slots of the current frame
+    std::vector<long> mValues;
+    unsigned mTop;
+    long *mFP;
+    /// The global segment
+    std::vector<long> mGlobals;
+    std::vector<VarDecl *> mGlobalDecls;
+
+    /// Resolved storage of every variable and number of slots of the frame of
+    /// every function, computed once in init
+    llvm::DenseMap<const Decl *, VarSlot> mSlots;
+    llvm::DenseMap<const FunctionDecl *, unsigned> mFrameSizes;
+    /// Layout of the local arrays, and every address the program can point
+    /// to with its local arrays, global arrays and heap
+    llvm::DenseMap<const VarDecl *, LocalArray> mLocalArrays;
+    llvm::DenseMap<const FunctionDecl *, long> mArrayBytes;
+    GuestMemory mMemory;
+    FrameArena mArena;
+    StaticArrays mStatics;
+    /// Return statements in tail position and the call they return
+    llvm::DenseMap<const Stmt *, CallExpr *> mTailCalls;
+    /// If statements with a constant condition and the branch they always
+    /// take, NULL if none
+    llvm::DenseMap<const IfStmt *, Stmt *> mPrunedIfs;
+    /// Functions whose result only depends on their arguments, and the cache
+    /// of their results if memoization is enabled
+    llvm::SetVector<const FunctionDecl *> mPure;
+    MemoCache *mMemo;
+
+    /// Side table of quickened expressions. Entries live in a deque so their
+    /// addresses stay valid while the table grows.
+    llvm::DenseMap<const Expr *, QuickInfo *> mQuick;
+    std::deque<QuickInfo> mQuickPool;
+
+    /// Call and loop counters of the JIT tier, created on first use
+    llvm::DenseMap<const FunctionDecl *, FunctionCounter *> mFunctionCounters;
+    llvm::DenseMap<const Stmt *, LoopCounter *> mLoopCounters;
+    std::deque<FunctionCounter> mFunctionCounterPool;
+    std::deque<LoopCounter> mLoopCounterPool;
 
     FunctionDecl *mFree;  /// Declartions to the built-in functions
     FunctionDecl *mMalloc;
@@ -113,32 +242,74 @@ class Environment {
     FunctionDecl *mOutput;
 
     FunctionDecl *mEntry;
+    /// Every function with a body, by name
+    llvm::StringMap<FunctionDecl *> mFunctions;
 
     Heap *mHeap;
+    GuestIO *mIO;  /// where GET reads from and PRINT writes to
 
    public:
-    /// Get the declartions to the built-in functions
-    Environment()
+    /// Get the declartions to the built-in functions. Guest memory reserves
+    /// memoryReserve bytes of address space, the default if 0.
+    explicit Environment(size_t memoryReserve = 0)
         : mStack(),
+          mGrowing(0),
+          mValues(),
+          mTop(0),
+          mFP(NULL),
+          mGlobals(),
+          mGlobalDecls(),
+          mSlots(),
+          mFrameSizes(),
+          mLocalArrays(),
+          mArrayBytes(),
+          mMemory(memoryReserve),
+          mArena(mMemory),
+          mStatics(mMemory),
+          mTailCalls(),
+          mPrunedIfs(),
+          mPure(),
+          mMemo(NULL),
+          mQuick(),
+          mQuickPool(),
+          mFunctionCounters(),
+          mLoopCounters(),
+          mFunctionCounterPool(),
+          mLoopCounterPool(),
           mFree(NULL),
           mMalloc(NULL),
           mInput(NULL),
           mOutput(NULL),
-          mEntry(NULL) {}
+          mEntry(NULL),
+          mFunctions(),
+          mHeap(NULL),
+          mIO(consoleIO()) {}
+    ~Environment() { delete mHeap; }
+
+    /// Read GET input from and write PRINT output to io
+    void setIO(GuestIO *io) { mIO = io; }
 
     /// Initialize the Environment
     void init(TranslationUnitDecl *unit) {
-        // global stackframe
-        mHeap = new Heap();
-        mStack.push_back(StackFrame());
+        mHeap = new Heap(mMemory);
+        std::vector<FunctionDecl *> bodies;
         for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
                                                 e = unit->decls_end();
              i != e; ++i) {
             // global values
             if (VarDecl *vdecl = dyn_cast<VarDecl>(*i)) {
-                vardecl(vdecl, &(mStack.back()));
+                VarSlot s = {true, (unsigned)mGlobals.size()};
+                mSlots[vdecl] = s;
+                mGlobals.push_back(0);
+                mGlobalDecls.push_back(vdecl);
+                if (vdecl->hasInit()) foldConstants(vdecl->getInit());
             }
             if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
+                if (fdecl->doesThisDeclarationHaveABody()) {
+                    resolve(fdecl);
+                    bodies.push_back(fdecl);
+                    mFunctions[fdecl->getName()] = fdecl;
+                }
                 if (fdecl->getName().equals("FREE"))
                     mFree = fdecl;
                 else if (fdecl->getName().equals("MALLOC"))
@@ -151,198 +322,453 @@ class Environment {
                     mEntry = fdecl;
             }
         }
-        mStack.push_back(StackFrame());
+        analyzePurity(bodies);
+        mStack.reserve(256);
+        mValues.resize(4096);
+        enterBottom();
     }
 
-    bool isExternalCall(FunctionDecl *f) {
-        return f == mFree || f == mMalloc || f == mInput || f == mOutput;
+    /// Return to the state init left: guest memory freed with the heap and
+    /// the arrays in it, the global segment and the call stack cleared. The
+    /// resolved slots, the quickened expressions and the JIT counters are
+    /// kept, the visitor runs the initializers of the globals again.
+    void reset() {
+        mMemory.clear();
+        delete mHeap;
+        mHeap = new Heap(mMemory);
+        mStatics.clear();
+        mArena.reset();
+        std::fill(mGlobals.begin(), mGlobals.end(), 0);
+        mStack.clear();
+        mTop = 0;
+        enterBottom();
     }
 
-    bool isCurFuncReturned() { return mStack.back().isReturned(); }
+    /// Save the state of the program to path, or to memory if path is
+    /// empty: the global segment, the value stack and the frames on it, and
+    /// the heap and arrays with the image of the memory holding them. key
+    /// identifies the program. Only the bottom frame may be on the stack,
+    /// between calls from outside: a frame keeps its slots and arrays, not
+    /// the statement it runs. NULL if a call is running or the snapshot
+    /// cannot be written.
+    std::unique_ptr<Snapshot> snapshot(const std::string &path,
+                                       const std::string &key) {
+        if (mStack.size() != 1) return std::unique_ptr<Snapshot>();
+        SnapshotWriter out;
+        out.put(mGlobals.size());
+        out.putBytes(mGlobals.data(), mGlobals.size() * sizeof(long));
+        out.put(mTop);
+        out.putBytes(mValues.data(), mTop * sizeof(long));
+        out.put(mStack.size());
+        for (unsigned i = 0; i < mStack.size(); i++) {
+            out.put(mStack[i].getBase());
+            out.put(mStack[i].getRetValue());
+            out.put((long)mStack[i].getArrays());
+        }
+        mMemory.save(out);
+        mHeap->save(out);
+        mStatics.save(out);
+        mArena.save(out);
+        return Snapshot::create(path, key, out, mMemory.imageBytes(),
+                                [this](int fd, off_t offset) {
+                                    return mMemory.writeImage(fd, offset);
+                                });
+    }
 
-    FunctionDecl *getEntry() { return mEntry; }
+    /// Return to the state saved in snapshot, which must have been taken of
+    /// the same program. Guest memory is mapped back copy on write, so this
+    /// costs the same whatever its size. Like snapshot, only between calls.
+    /// False if a call is running, leaving the state alone, or if the
+    /// snapshot does not fit the program or its memory cannot be placed at
+    /// the address it was taken at, which another Environment of the
+    /// process holds; the state is then undefined until reset.
+    bool restore(const Snapshot &snapshot) {
+        if (mStack.size() != 1) return false;
+        SnapshotReader in = snapshot.state();
+        long count, top, depth;
+        if (!in.get(count) || count != (long)mGlobals.size()) return false;
+        std::vector<long> globals(count);
+        if (!in.getBytes(globals.data(), count * sizeof(long)) ||
+            !in.get(top) || top < 0 || top > UINT_MAX)
+            return false;
+        std::vector<long> values(top);
+        if (!in.getBytes(values.data(), top * sizeof(long)) ||
+            !in.get(depth) || depth != 1)
+            return false;
+        std::vector<StackFrame> frames;
+        for (long i = 0; i < depth; i++) {
+            long base, retValue, arrays;
+            if (!in.get(base) || !in.get(retValue) || !in.get(arrays) ||
+                base < 0 || base > top)
+                return false;
+            frames.emplace_back(base);
+            frames.back().setRetValue(retValue);
+            frames.back().setArrays((char *)arrays);
+        }
+        if (!mMemory.load(in)) return false;
+        delete mHeap;
+        mHeap = new Heap(mMemory);
+        if (!mHeap->load(in) || !mStatics.load(in) || !mArena.load(in) ||
+            !mMemory.mapImage(snapshot.fd(), snapshot.imageOffset(),
+                              snapshot.imageBytes()))
+            return false;
+        // compiled code holds the address of the global segment
+        std::copy(globals.begin(), globals.end(), mGlobals.begin());
+        if ((size_t)top > mValues.size()) mValues.resize(2 * top);
+        std::copy(values.begin(), values.end(), mValues.begin());
+        mTop = top;
+        mGrowing = 1;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        mStack.swap(frames);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        mGrowing = 0;
+        mFP = &mValues[mStack.back().getBase()];
+        return true;
+    }
 
-    // bind int literal stmt and value
-    void integerLiteral(IntegerLiteral *literal) {
-        long value = (long)literal->getValue().getLimitedValue();
-        mStack.back().bindStmt(literal, value);
+    /// Push the frame of main, or an empty one if the program has no main,
+    /// which the globals are initialized in and calls from outside return to
+    void enterBottom() {
+        if (mEntry)
+            enter(reserveFrame(frameSize(mEntry), mEntry->getNumParams()));
+        else
+            enter(reserveFrame(0, 0));
     }
 
-    void characterLiteral(CharacterLiteral *cl) {
-        long value = (long)cl->getValue();
-        mStack.back().bindStmt(cl, value);
+    /// Give the parameters and locals of fdecl dense slot indexes
+    void resolve(FunctionDecl *fdecl) {
+        unsigned index = 0;
+        for (unsigned i = 0; i < fdecl->getNumParams(); i++) {
+            VarSlot s = {false, index++};
+            mSlots[fdecl->getParamDecl(i)] = s;
+        }
+        BodyScanner scanner;
+        scanner.TraverseStmt(fdecl->getBody());
+        std::vector<VarDecl *> arrays;
+        long arrayBytes = 0;
+        for (unsigned i = 0; i < scanner.mLocals.size(); i++) {
+            VarDecl *vdecl = scanner.mLocals[i];
+            VarSlot s = {false, index++};
+            mSlots[vdecl] = s;
+            if (vdecl->getType()->isArrayType() &&
+                !vdecl->hasGlobalStorage()) {
+                // every array of the frame has storage of its own, reused
+                // each time its declaration runs again
+                long size = TypeLayout::sizeOf(vdecl->getType());
+                LocalArray a = {arrayBytes, size, 0};
+                mLocalArrays[vdecl] = a;
+                arrays.push_back(vdecl);
+                arrayBytes += FrameArena::align(size);
+            }
+        }
+        for (unsigned i = 0; i < arrays.size(); i++)
+            mLocalArrays[arrays[i]].frameBytes = arrayBytes;
+        mFrameSizes[fdecl->getCanonicalDecl()] = index;
+        mArrayBytes[fdecl->getCanonicalDecl()] = arrayBytes;
+        // a tail call would release the arrays of the frame while the
+        // callee may still point into them
+        if (!arrayBytes)
+            for (unsigned i = 0; i < scanner.mTailCalls.size(); i++)
+                mTailCalls[scanner.mTailCalls[i].first] =
+                    scanner.mTailCalls[i].second;
+        foldConstants(fdecl->getBody());
     }
 
-    long expr(Expr *exp) {
-        Expr *e = exp->IgnoreImpCasts();
-        if (BinaryOperator *bop = dyn_cast<BinaryOperator>(e)) {
-            binop(bop);
-            return mStack.back().getStmtVal(bop);
-        } else if (IntegerLiteral *integerLiteral =
-                       dyn_cast<IntegerLiteral>(e)) {
-            long value = (long)integerLiteral->getValue().getSExtValue();
-            // long value = mStack.back().getStmtVal(integerLiteral);
-            return value;
+    /// Quicken the largest constant subexpressions of s to their value and
+    /// record the branch taken by if statements with a constant condition,
+    /// so none of them is evaluated at run time. Branches that never run are
+    /// skipped.
+    void foldConstants(Stmt *s) {
+        if (!s) return;
+        if (Expr *e = dyn_cast<Expr>(s)) {
+            long value;
+            if (ConstantFolder::fold(e, value)) {
+                mQuickPool.emplace_back();
+                QuickInfo *q = &mQuickPool.back();
+                q->handler = QuickInfo::Const;
+                q->value = value;
+                mQuick[e] = q;
+                return;
+            }
+        } else if (IfStmt *ifstmt = dyn_cast<IfStmt>(s)) {
+            Stmt *taken;
+            if (ConstantFolder::prune(ifstmt, taken)) {
+                mPrunedIfs[ifstmt] = taken;
+                foldConstants(taken);
+                return;
+            }
+        }
+        for (Stmt::child_iterator it = s->child_begin(), ie = s->child_end();
+             it != ie; ++it)
+            foldConstants(*it);
+    }
+
+    /// Returns true if the condition of ifstmt was found constant at load
+    /// time and sets taken to the branch to run, NULL if none
+    bool prunedIf(IfStmt *ifstmt, Stmt *&taken) {
+        if (mPrunedIfs.empty()) return false;
+        llvm::DenseMap<const IfStmt *, Stmt *>::iterator it =
+            mPrunedIfs.find(ifstmt);
+        if (it == mPrunedIfs.end()) return false;
+        taken = it->second;
+        return true;
+    }
+
+    /// A function is pure if its body is and it only calls pure functions.
+    /// Every function starts out pure and those calling an impure one are
+    /// dropped until nothing changes, so recursive functions can stay pure.
+    void analyzePurity(const std::vector<FunctionDecl *> &bodies) {
+        llvm::DenseMap<const FunctionDecl *, std::vector<const FunctionDecl *> >
+            callees;
+        for (unsigned i = 0; i < bodies.size(); i++) {
+            PurityScanner scanner;
+            scanner.TraverseStmt(bodies[i]->getBody());
+            if (scanner.mImpure) continue;
+            mPure.insert(bodies[i]->getCanonicalDecl());
+            callees[bodies[i]->getCanonicalDecl()] = scanner.mCallees;
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (unsigned i = 0; i < bodies.size(); i++) {
+                const FunctionDecl *fdecl = bodies[i]->getCanonicalDecl();
+                if (!mPure.count(fdecl)) continue;
+                const std::vector<const FunctionDecl *> &called =
+                    callees[fdecl];
+                for (unsigned j = 0; j < called.size(); j++) {
+                    if (!mPure.count(called[j])) {
+                        mPure.remove(fdecl);
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    bool isPure(FunctionDecl *fdecl) {
+        return mPure.count(fdecl->getCanonicalDecl());
+    }
+
+    /// Cache the results of calls of pure functions in memo
+    void setMemo(MemoCache *memo) {
+        mMemo = memo;
+        for (unsigned i = 0; i < mPure.size(); i++)
+            memo->addFunction(mPure[i], mPure[i]->getNameAsString());
+    }
+
+    unsigned frameSize(FunctionDecl *fdecl) {
+        return mFrameSizes.lookup(fdecl->getCanonicalDecl());
+    }
+
+    /// The storage of a resolved variable
+    long &slot(Decl *decl) {
+        llvm::DenseMap<const Decl *, VarSlot>::iterator it = mSlots.find(decl);
+        assert(it != mSlots.end());
+        if (it->second.global) return mGlobals[it->second.index];
+        return mFP[it->second.index];
+    }
+
+    /// The quickened form of e, resolved the first time e runs
+    QuickInfo *quicken(Expr *e) {
+        QuickInfo *&q = mQuick[e];
+        if (!q) {
+            mQuickPool.emplace_back();
+            q = &mQuickPool.back();
+            resolveQuick(e, q);
+        }
+        return q;
+    }
+
+    void resolveQuick(Expr *e, QuickInfo *q) {
+        if (IntegerLiteral *il = dyn_cast<IntegerLiteral>(e)) {
+            q->handler = QuickInfo::Const;
+            q->value = integerLiteral(il);
         } else if (CharacterLiteral *cl = dyn_cast<CharacterLiteral>(e)) {
-            long value = cl->getValue();
-            return value;
-        } else if (DeclRefExpr *dref = dyn_cast<DeclRefExpr>(e)) {
-            declref(
-                dref);  // have to do this. Global declref havn't been visited
-            long value = mStack.back().getStmtVal(dref);
-            return value;
-        } else if (CallExpr *cexpr = dyn_cast<CallExpr>(e)) {
-            long value = mStack.back().getStmtVal(cexpr);
-            return value;
-        } else if (UnaryOperator *uo = dyn_cast<UnaryOperator>(e)) {
-            long value = mStack.back().getStmtVal(uo);
-            return value;
-        } else if (ParenExpr *pe = dyn_cast<ParenExpr>(e)) {
-            long value = mStack.back().getStmtVal(pe);
-            return value;
-        } else if (ArraySubscriptExpr *ae = dyn_cast<ArraySubscriptExpr>(e)) {
-            long value = mStack.back().getStmtVal(ae);
-            return value;
+            q->handler = QuickInfo::Const;
+            q->value = characterLiteral(cl);
         } else if (UnaryExprOrTypeTraitExpr *tte =
                        dyn_cast<UnaryExprOrTypeTraitExpr>(e)) {
-            long value = mStack.back().getStmtVal(tte);
-            return value;
-        } else if (CStyleCastExpr *cce = dyn_cast<CStyleCastExpr>(e)) {
-            // long addr = expr(cce->getSubExpr());
-            // long* addr = (long*) t;
-            long value = expr(cce->getSubExpr());
-            return value;
-        } else {
-            printf("Expr not hanled.\n");
-            return -1;
+            q->handler = QuickInfo::Const;
+            q->value = tte->getKind() == UETT_SizeOf ? sizeofexpr(tte) : 0;
+        } else if (ParenExpr *pe = dyn_cast<ParenExpr>(e)) {
+            q->handler = QuickInfo::Pass;
+            q->lhs = pe->getSubExpr();
+        } else if (CastExpr *ce = dyn_cast<CastExpr>(e)) {
+            q->handler = QuickInfo::Pass;
+            q->lhs = ce->getSubExpr();
+        } else if (DeclRefExpr *dref = dyn_cast<DeclRefExpr>(e)) {
+            llvm::DenseMap<const Decl *, VarSlot>::iterator it =
+                mSlots.find(dref->getFoundDecl());
+            if (it != mSlots.end()) {
+                q->handler =
+                    it->second.global ? QuickInfo::Global : QuickInfo::Local;
+                q->value = it->second.index;
+            }
+        } else if (BinaryOperator *bop = dyn_cast<BinaryOperator>(e)) {
+            if (!bop->isAssignmentOp()) {
+                q->handler = QuickInfo::Binary;
+                q->op = bop->getOpcode();
+                q->lhs = bop->getLHS();
+                q->rhs = bop->getRHS();
+                if (bop->isAdditiveOp() &&
+                    !q->rhs->getType()->isPointerType())
+                    q->scale = TypeLayout::stride(q->lhs->getType());
+            }
+        } else if (CallExpr *call = dyn_cast<CallExpr>(e)) {
+            FunctionDecl *callee = call->getDirectCallee();
+            q->callee = callee;
+            if (callee == mInput) {
+                q->handler = QuickInfo::Builtin;
+                q->value = QuickInfo::BI_Input;
+            } else if (callee == mOutput) {
+                q->handler = QuickInfo::Builtin;
+                q->value = QuickInfo::BI_Output;
+            } else if (callee == mMalloc) {
+                q->handler = QuickInfo::Builtin;
+                q->value = QuickInfo::BI_Malloc;
+            } else if (callee == mFree) {
+                q->handler = QuickInfo::Builtin;
+                q->value = QuickInfo::BI_Free;
+            } else {
+                q->handler = QuickInfo::Call;
+                q->body = callee->getBody();
+                q->frameSize =
+                    std::max(frameSize(callee), callee->getNumParams());
+                q->memo = mMemo && isPure(callee);
+                q->counter = functionCounter(callee);
+            }
         }
     }
 
-    void parenexpr(ParenExpr *pe) {
-        Expr *e = pe->getSubExpr();
-        long value = expr(e);
-        mStack.back().bindStmt(pe, value);
+    /// Values of resolved variables; an array evaluates to its base address
+    long local(unsigned index) { return mFP[index]; }
+    long global(unsigned index) { return mGlobals[index]; }
+
+    FunctionDecl *getEntry() { return mEntry; }
+
+    /// The function called name with a body, NULL if there is none
+    FunctionDecl *lookupFunction(llvm::StringRef name) {
+        return mFunctions.lookup(name);
     }
 
-    void sizeofexpr(UnaryExprOrTypeTraitExpr *tte) {
-        long value = sizeof(long);
-        mStack.back().bindStmt(tte, value);
+    /// The storage of decl, false if it is not a resolved variable
+    bool lookupSlot(const Decl *decl, VarSlot &s) {
+        llvm::DenseMap<const Decl *, VarSlot>::iterator it = mSlots.find(decl);
+        if (it == mSlots.end()) return false;
+        s = it->second;
+        return true;
     }
 
-    void unaryop(UnaryOperator *uop) {
-        Expr *e = uop->getSubExpr();
-        long value = expr(e);
+    /// The global segment and the slots of the current frame
+    long *globalSlots() { return mGlobals.empty() ? NULL : &mGlobals[0]; }
+    long *frame() { return mFP; }
+
+    FunctionCounter *functionCounter(FunctionDecl *fdecl) {
+        FunctionCounter *&counter =
+            mFunctionCounters[fdecl->getCanonicalDecl()];
+        if (!counter) {
+            mFunctionCounterPool.emplace_back();
+            counter = &mFunctionCounterPool.back();
+        }
+        return counter;
+    }
+
+    LoopCounter *loopCounter(Stmt *loop) {
+        LoopCounter *&counter = mLoopCounters[loop];
+        if (!counter) {
+            mLoopCounterPool.emplace_back();
+            counter = &mLoopCounterPool.back();
+        }
+        return counter;
+    }
+
+    Heap *getHeap() { return mHeap; }
+
+    /// Globals in declaration order; their initializers are run by the
+    /// visitor once init has pushed the frame of main
+    const std::vector<VarDecl *> &getGlobals() { return mGlobalDecls; }
+
+    long integerLiteral(IntegerLiteral *literal) {
+        return (long)literal->getValue().getLimitedValue();
+    }
+
+    long characterLiteral(CharacterLiteral *cl) { return (long)cl->getValue(); }
+
+    long sizeofexpr(UnaryExprOrTypeTraitExpr *tte) {
+        return TypeLayout::sizeOf(tte->getTypeOfArgument());
+    }
+
+    long unaryop(UnaryOperator *uop, long value) {
         if (uop->getOpcode() == UO_Plus) {
-            mStack.back().bindStmt(uop, value);
+            return value;
         } else if (uop->getOpcode() == UO_Minus) {
-            mStack.back().bindStmt(uop, -value);
+            return -value;
         } else if (uop->getOpcode() == UO_Deref) {
-            mStack.back().bindStmt(uop, mHeap->Get((long *)value));
+            return mHeap->Get((long *)value,
+                              TypeLayout::sizeOf(uop->getType()));
         }
+        llvm::errs() << "Unary Op not Identified.\n";
+        return 0;
     }
 
-    /// !TODO Support comparison operation
-    void binop(BinaryOperator *bop) {
-        Expr *left = bop->getLHS();
-        Expr *right = bop->getRHS();
-
-        //    llvm::errs() << "binop.\n";
-        if (bop->isAssignmentOp()) {  // =
-            long val = expr(right);
-            if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(left)) {
-                mStack.back().bindStmt(left, val);
-                Decl *decl = declexpr->getFoundDecl();
-                if (mStack.back().findDecl(decl))
-                    mStack.back().bindDecl(decl, val);
-                else
-                    mStack.front().bindDecl(decl, val);
-            } else if (ArraySubscriptExpr *aexpr =
-                           dyn_cast<ArraySubscriptExpr>(left)) {
-                long index = expr(aexpr->getIdx());
-                DeclRefExpr *declref =
-                    dyn_cast<DeclRefExpr>(aexpr->getLHS()->IgnoreImpCasts());
-                if (!declref) printf("ERROR: Array reference not known.\n");
-                Decl *decl = declref->getFoundDecl();
-                long temp = mStack.back().findDecl(decl)
-                                ? mStack.back().getDeclVal(decl)
-                                : mStack.front().getDeclVal(decl);
-                long *arr = (long *)temp;
-                arr[index] = val;
-            } else if (UnaryOperator *uope = dyn_cast<UnaryOperator>(left)) {
-                long lval = expr(uope->getSubExpr());
-                long *addr = (long *)lval;
-                mHeap->Update(addr, val);
-            } else {
-                printf("shouldn't be here\n");
-            }
-        } else if (bop->isAdditiveOp()) {  // + -
-            long valr = expr(right);
-            long vall = expr(left);
-            long res = 0;
-            if (left->getType().getTypePtr()->isPointerType() &&
-                !right->getType().getTypePtr()->isPointerType()) {
-                valr *= sizeof(long);
-            } else if (!right->getType().getTypePtr()->isPointerType() &&
-                       left->getType().getTypePtr()->isPointerType()) {
-                vall *= sizeof(long);
-            }
-            if (bop->getOpcode() == BO_Add) {
-                res = vall + valr;
-            } else {
-                res = vall - valr;
-            }
-            mStack.back().bindStmt(bop, res);
-        } else if (bop->isMultiplicativeOp()) {  // * /
-            long valr = expr(right);
-            long vall = expr(left);
-            long res = 0;
-            if (bop->getOpcode() == BO_Mul) {
-                res = vall * valr;
-            } else {
-                res = vall / valr;
-            }
-            mStack.back().bindStmt(bop, res);
-        } else if (bop->isComparisonOp()) {  // > < >= <= == !=
-            long valr = expr(right);
-            long vall = expr(left);
-            long res = 0;
-            switch (bop->getOpcode()) {
-                case BO_GT:
-                    res = (vall > valr);
-                    break;
-                case BO_LT:
-                    res = (vall < valr);
-                    break;
-                case BO_EQ:
-                    res = (vall == valr);
-                    break;
-                case BO_GE:
-                    res = (vall >= valr);
-                    break;
-                case BO_LE:
-                    res = (vall <= valr);
-                    break;
-                case BO_NE:
-                    res = (vall != valr);
-                    break;
-                default:
-                    llvm::errs() << "Comparison Op not Identified.\n";
-                    break;
-            }
-            mStack.back().bindStmt(bop, res);
+    /// Arithmetic and comparison of a quickened BinaryOperator on already
+    /// evaluated operands
+    long arith(const QuickInfo *q, long vall, long valr) {
+        if (q->scale) valr *= q->scale;
+        switch (q->op) {
+            case BO_Add:
+                return vall + valr;
+            case BO_Sub:
+                return vall - valr;
+            case BO_Mul:
+                return vall * valr;
+            case BO_Div:
+                return vall / valr;
+            case BO_Rem:
+                return vall % valr;
+            case BO_GT:
+                return vall > valr;
+            case BO_LT:
+                return vall < valr;
+            case BO_EQ:
+                return vall == valr;
+            case BO_GE:
+                return vall >= valr;
+            case BO_LE:
+                return vall <= valr;
+            case BO_NE:
+                return vall != valr;
+            default:
+                llvm::errs() << "Binary Op not Identified.\n";
+                return 0;
         }
     }
 
+    /// Stores of an assignment, one per kind of assignable expression
+    void assignVar(DeclRefExpr *declexpr, long val) {
+        QuickInfo *q = quicken(declexpr);
+        if (q->handler == QuickInfo::Global)
+            mGlobals[q->value] = val;
+        else
+            mFP[q->value] = val;
+    }
+
+    void assignElement(ArraySubscriptExpr *aexpr, long base, long index,
+                       long val) {
+        long size = TypeLayout::sizeOf(aexpr->getType());
+        TypeLayout::store((char *)base + index * size, size, val);
+    }
+
+    void assignDeref(UnaryOperator *uop, long addr, long val) {
+        mHeap->Update((long *)addr, val, TypeLayout::sizeOf(uop->getType()));
+    }
+
     // handle var delarations.
-    void vardecl(VarDecl *vdecl, StackFrame *sf) {
+    void vardecl(VarDecl *vdecl, long init) {
         if (vdecl->getType().getTypePtr()->isIntegerType() ||
             vdecl->getType().getTypePtr()->isCharType()) {
-            long value = 0;
-            if (vdecl->hasInit()) {
-                Expr *e = vdecl->getInit();
-                value = expr(e);
-            }
-            sf->bindDecl(vdecl, value);
+            slot(vdecl) = vdecl->hasInit() ? init : 0;
         } else if (vdecl->getType().getTypePtr()->isArrayType()) {
             const ConstantArrayType *atype =
                 dyn_cast<ConstantArrayType>(vdecl->getType().getTypePtr());
@@ -350,137 +776,189 @@ class Environment {
             if (asize <= 0) {
                 llvm::errs() << "Error: Invalid Array Size " << asize << ".\n";
             }
-            if (atype->getElementType().getTypePtr()->isIntegerType()) {
-                long *temp = new long[asize];
-                for (int i = 0; i < asize; i++) temp[i] = 0;
-                sf->bindDecl(vdecl, (long)temp);
-            } else if (atype->getElementType().getTypePtr()->isPointerType()) {
-                long **temp = new long *[asize];
-                for (int i = 0; i < asize; i++) temp[i] = 0;
-                sf->bindDecl(vdecl, (long)temp);
+            const Type *element = atype->getElementType().getTypePtr();
+            if (element->isIntegerType() || element->isPointerType()) {
+                // elements are packed at their own size, zero filled
+                slot(vdecl) = vdecl->hasGlobalStorage()
+                                  ? (long)staticArray(vdecl)
+                                  : (long)localArray(vdecl);
             }
         } else if (vdecl->getType().getTypePtr()->isPointerType()) {
-            long value = 0;
-            if (vdecl->hasInit()) {
-                Expr *e = vdecl->getInit();
-                value = expr(e);
-            }
-            sf->bindDecl(vdecl, value);
+            slot(vdecl) = vdecl->hasInit() ? init : 0;
         } else {
-            sf->bindDecl(vdecl, 0);
+            slot(vdecl) = 0;
         }
     }
 
-    void decl(DeclStmt *declstmt) {
-        for (DeclStmt::decl_iterator it = declstmt->decl_begin(),
-                                     ie = declstmt->decl_end();
-             it != ie; ++it) {
-            Decl *decl = *it;
-            if (VarDecl *vdecl = dyn_cast<VarDecl>(decl)) {
-                vardecl(vdecl, &(mStack.back()));
-            }
-        }
+    /// The storage of an array living as long as the program
+    char *staticArray(VarDecl *vdecl) {
+        return mStatics.allocate(TypeLayout::sizeOf(vdecl->getType()));
     }
-    void declref(DeclRefExpr *declref) {
-        mStack.back().setPC(declref);
-        if (declref->getType()->isIntegerType() ||
-            declref->getType()->isPointerType()) {
-            Decl *decl = declref->getFoundDecl();
-            // global or local value
-            long val = mStack.back().findDecl(decl)
-                           ? mStack.back().getDeclVal(decl)
-                           : mStack.front().getDeclVal(decl);
-            mStack.back().bindStmt(declref, val);
-        } else {
-            //    printf("wtf!\n");
-        }
+
+    /// The storage of a local array in the current frame, zero filled. The
+    /// arrays of a frame are pushed on the arena together when the first of
+    /// them is declared, and popped when the frame returns.
+    char *localArray(VarDecl *vdecl) {
+        const LocalArray &a = mLocalArrays.find(vdecl)->second;
+        StackFrame &frame = mStack.back();
+        if (!frame.getArrays()) frame.setArrays(mArena.push(a.frameBytes));
+        char *array = frame.getArrays() + a.offset;
+        ZeroPages::zero(array, a.size);
+        return array;
     }
 
-    void arrayref(ArraySubscriptExpr *aexpr) {
-        long index = expr(aexpr->getIdx());
-        DeclRefExpr *declref =
-            dyn_cast<DeclRefExpr>(aexpr->getLHS()->IgnoreImpCasts());
-        if (!declref) printf("ERROR: Array reference not known.\n");
-        Decl *decl = declref->getFoundDecl();
-        long temp = mStack.back().findDecl(decl)
-                        ? mStack.back().getDeclVal(decl)
-                        : mStack.front().getDeclVal(decl);
-        long *arr = (long *)temp;
-        mStack.back().bindStmt(aexpr, arr[index]);
-    }
-
-    void cast(CastExpr *castexpr) {
-        mStack.back().setPC(castexpr);
-        if (castexpr->getType()->isIntegerType()) {
-            Expr *expr = castexpr->getSubExpr();
-            long val = mStack.back().getStmtVal(expr);
-            mStack.back().bindStmt(castexpr, val);
-        } else if (castexpr->getType()->isPointerType()) {
-            // printf("Pointer\n");
+    /// Where the local array vdecl lives, NULL if it is not one
+    const LocalArray *lookupLocalArray(const VarDecl *vdecl) {
+        llvm::DenseMap<const VarDecl *, LocalArray>::iterator it =
+            mLocalArrays.find(vdecl);
+        return it == mLocalArrays.end() ? NULL : &it->second;
+    }
+
+    /// Bytes of the local arrays of a frame of fdecl
+    long arrayBytes(const FunctionDecl *fdecl) {
+        return mArrayBytes.lookup(fdecl->getCanonicalDecl());
+    }
+
+    /// Automatic storage of frames the walker does not push, those of
+    /// compiled functions
+    FrameArena &getArena() { return mArena; }
+
+    long arrayref(ArraySubscriptExpr *aexpr, long base, long index) {
+        long size = TypeLayout::sizeOf(aexpr->getType());
+        return TypeLayout::load((char *)base + index * size, size);
+    }
+
+    /// Reserve the slots of a frame of callee on top of the value stack,
+    /// above any frame pushed while its arguments are evaluated. Returns the
+    /// base of the frame.
+    unsigned reserveFrame(unsigned size, unsigned numParams) {
+        unsigned base = mTop;
+        if (base + size > mValues.size()) {
+            mValues.resize(2 * (base + size));
+            if (!mStack.empty()) mFP = &mValues[mStack.back().getBase()];
         }
+        std::fill(&mValues[0] + base + numParams, &mValues[0] + base + size,
+                  0);
+        mTop = base + size;
+        return base;
+    }
+
+    unsigned call(CallExpr *callexpr, const QuickInfo *q) {
+        mStack.back().setPC(callexpr);
+        return reserveFrame(q->frameSize, q->callee->getNumParams());
+    }
+
+    /// Write an argument straight into a parameter slot of a reserved frame
+    void bindArg(unsigned base, unsigned index, long val) {
+        mValues[base + index] = val;
     }
 
-    void ret(CallExpr *callexpr) {
-        FunctionDecl *callee = callexpr->getDirectCallee();
-        if (callee->isNoReturn()) {
-            mStack.pop_back();
+    /// The call returned by rstmt if it is a tail call
+    CallExpr *tailCall(ReturnStmt *rstmt) { return mTailCalls.lookup(rstmt); }
+
+    /// Turn the current frame into a frame of the callee of a tail call,
+    /// binding the already evaluated arguments
+    void reuseFrame(CallExpr *callexpr, const QuickInfo *q,
+                    llvm::ArrayRef<long> args) {
+        mStack.back().setPC(callexpr);
+        releaseArrays(mStack.back());
+        mTop = mStack.back().getBase();
+        unsigned base = reserveFrame(q->frameSize, args.size());
+        for (unsigned i = 0; i < args.size(); i++) mValues[base + i] = args[i];
+    }
+
+    /// The cached result of a call of a memoized function
+    bool memoLookup(const QuickInfo *q, llvm::ArrayRef<long> args,
+                    long &value) {
+        return mMemo->lookup(q->callee->getCanonicalDecl(), args.data(),
+                             args.size(), value);
+    }
+
+    void memoInsert(const QuickInfo *q, llvm::ArrayRef<long> args,
+                    long value) {
+        mMemo->insert(q->callee->getCanonicalDecl(), args.data(), args.size(),
+                      value);
+    }
+
+    /// Make the reserved frame at base the current one
+    void enter(unsigned base) {
+        if (mStack.size() == mStack.capacity()) {
+            mGrowing = 1;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            mStack.emplace_back(base);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            mGrowing = 0;
         } else {
-            long rval = mStack.back().getRetValue();
-            mStack.pop_back();
-            mStack.back().bindStmt(callexpr, rval);
+            mStack.emplace_back(base);
         }
-        //printf("\tret\n");
+        mFP = &mValues[base];
     }
 
-    void retstmt(ReturnStmt *rstmt) {
-        Expr *rexpr = rstmt->getRetValue();
-        if (rexpr) {
-            long rval = expr(rexpr);
-            mStack.back().setRetValue(rval);
-        }
-        mStack.back().setReturned();
-        //printf("\tretstmt\n");
+    long ret(CallExpr *callexpr) {
+        long rval = mStack.back().getRetValue();
+        releaseArrays(mStack.back());
+        mTop = mStack.back().getBase();
+        mStack.pop_back();
+        mFP = &mValues[mStack.back().getBase()];
+        return rval;
+    }
+
+    void releaseArrays(StackFrame &frame) {
+        if (!frame.getArrays()) return;
+        mArena.pop(frame.getArrays());
+        frame.setArrays(NULL);
+    }
+
+    /// Frames on the call stack
+    unsigned depth() { return mStack.size(); }
+
+    /// Record that the current frame runs stmt
+    void setPC(Stmt *stmt) { mStack.back().setPC(stmt); }
+
+    /// The statements the innermost max frames are running, innermost first.
+    /// Safe to call from a signal handler interrupting the walker; returns 0
+    /// if the stack cannot be read at the moment.
+    unsigned backtrace(const Stmt **pcs, unsigned max) {
+        if (mGrowing) return 0;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        unsigned depth = std::min<size_t>(mStack.size(), max);
+        for (unsigned i = 0; i < depth; i++)
+            pcs[i] = mStack[mStack.size() - 1 - i].getPC();
+        return depth;
+    }
+
+    void retstmt(long rval) {
+        mStack.back().setRetValue(rval);
     }
 
-    /// !TODO Support Function Call
-    void call(CallExpr *callexpr) {
-        //printf("\tcall\n");
+    /// Run a built-in function
+    long builtin(CallExpr *callexpr, const QuickInfo *q,
+                 llvm::ArrayRef<long> args) {
         mStack.back().setPC(callexpr);
         long val = 0;
-        FunctionDecl *callee = callexpr->getDirectCallee();
-        if (callee == mInput) {
-            llvm::errs() << "Please Input an Integer Value : ";
-            scanf("%ld", &val);
-
-            mStack.back().bindStmt(callexpr, val);
-        } else if (callee == mOutput) {
-            Expr *e = callexpr->getArg(0);
-            val = expr(e);
-            llvm::errs() << val << "\n";
-        } else if (callee == mMalloc) {
-            Expr *e = callexpr->getArg(0);
-            val = expr(e);
-            long *addr = mHeap->Malloc(val);
-            mStack.back().bindStmt(callexpr, (long)addr);
-        } else if (callee == mFree) {
-            Expr *e = callexpr->getArg(0);
-            val = expr(e);
-            long *addr = (long *)val;
-            mHeap->Free(addr);
-        }
-
-        else {
-            /// You could add your code here for Function call Return
-            StackFrame calleeStack = StackFrame();
-            unsigned param_num = callee->getNumParams();
-            for (unsigned i = 0; i < param_num; i++) {
-                Expr *e = callexpr->getArg(i);
-                long val = expr(e);
-                VarDecl *vd = dyn_cast<VarDecl>(callee->getParamDecl(i));
-                vardecl(vd, &calleeStack);
-                calleeStack.bindDecl(vd, val);
-            }
-            mStack.push_back(calleeStack);
+        switch (q->value) {
+            case QuickInfo::BI_Input:
+                val = input();
+                break;
+            case QuickInfo::BI_Output:
+                output(args[0]);
+                break;
+            case QuickInfo::BI_Malloc:
+                val = (long)mHeap->Malloc(args[0]);
+                break;
+            case QuickInfo::BI_Free:
+                mHeap->Free((long *)args[0]);
+                break;
         }
+        return val;
     }
+
+    /// GET and PRINT
+    long input() { return mIO->input(); }
+
+    void output(long val) { mIO->output(val); }
+
+    void flush() { mIO->flush(); }
 };
+
+#endif
@@ -0,0 +1,138 @@
+//==--- FrameArena.h - Stack allocator for the local arrays of frames -----===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_FRAME_ARENA_H
+#define AST_INTERPRETER_FRAME_ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "GuestMemory.h"
+#include "Snapshot.h"
+#include "ZeroPages.h"
+
+/// Automatic storage of guest frames. Every frame that declares a local
+/// array pushes one block holding all of its arrays and pops it when it
+/// returns, so the arena grows and shrinks with the call stack. Blocks are
+/// carved out of chunks that are kept once allocated: after the deepest
+/// call has been reached, local arrays cost no allocation at all. Blocks
+/// never move, since the guest holds their addresses. Chunks come from the
+/// GuestMemory, so a large array is cleared with ZeroPages::zero without
+/// touching its pages.
+class FrameArena {
+    static const size_t kChunkSize = 1 << 20;
+    static const size_t kAlign = 16;
+
+    struct Chunk {
+        char *mem;
+        size_t size;
+    };
+
+    GuestMemory &mMemory;
+    /// Chunks below mCurrent are full, chunks above it are spare
+    std::vector<Chunk> mChunks;
+    unsigned mCurrent;
+    size_t mUsed;  /// bytes of the current chunk in use
+
+   public:
+    explicit FrameArena(GuestMemory &memory)
+        : mMemory(memory), mChunks(), mCurrent(0), mUsed(0) {}
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    /// Round a size up so blocks and the arrays inside them stay aligned
+    static size_t align(size_t bytes) {
+        return (bytes + kAlign - 1) & ~(kAlign - 1);
+    }
+
+    /// A block of bytes on top of the arena, not initialized
+    char *push(size_t bytes) {
+        bytes = align(bytes);
+        if (bytes < kAlign) bytes = kAlign;
+        if (mChunks.empty() || mUsed + bytes > mChunks[mCurrent].size) {
+            unsigned next = mChunks.empty() ? 0 : mCurrent + 1;
+            if (next < mChunks.size() && mChunks[next].size < bytes) {
+                mMemory.release(mChunks[next].mem, mChunks[next].size);
+                mChunks[next].mem = NULL;
+                mChunks[next].size = 0;
+            }
+            if (next == mChunks.size()) mChunks.push_back(Chunk());
+            if (!mChunks[next].mem) {
+                size_t size = bytes < kChunkSize ? kChunkSize : bytes;
+                mChunks[next].mem = mMemory.allocate(size);
+                if (!mChunks[next].mem) {
+                    fprintf(stderr, "Error: cannot allocate %zu bytes.\n",
+                            size);
+                    abort();
+                }
+                mChunks[next].size = size;
+            }
+            mCurrent = next;
+            mUsed = 0;
+        }
+        char *block = mChunks[mCurrent].mem + mUsed;
+        mUsed += bytes;
+        return block;
+    }
+
+    /// Release block and every block pushed after it
+    void pop(char *block) {
+        while (block < mChunks[mCurrent].mem ||
+               block >= mChunks[mCurrent].mem + mChunks[mCurrent].size)
+            mCurrent--;
+        mUsed = block - mChunks[mCurrent].mem;
+    }
+
+    /// Release every block
+    void clear() {
+        mCurrent = 0;
+        mUsed = 0;
+    }
+
+    /// Forget every chunk, once GuestMemory::clear has freed them
+    void reset() {
+        mChunks.clear();
+        clear();
+    }
+
+    void save(SnapshotWriter &out) const {
+        out.put(mCurrent);
+        out.put(mUsed);
+        out.put(mChunks.size());
+        for (unsigned i = 0; i < mChunks.size(); i++) {
+            out.put((long)mChunks[i].mem);
+            out.put(mChunks[i].size);
+        }
+    }
+
+    /// Replace the chunks by what save wrote. Called after the GuestMemory
+    /// is loaded, every chunk must lie in it. False if the state is damaged.
+    bool load(SnapshotReader &in) {
+        long current, used, count;
+        if (!in.get(current) || !in.get(used) || !in.get(count) ||
+            count < 0 || (size_t)count > in.remaining() / (2 * sizeof(long)) ||
+            current < 0 || (count ? current >= count : current || used))
+            return false;
+        std::vector<Chunk> chunks(count);
+        for (long i = 0; i < count; i++) {
+            long mem, size;
+            if (!in.get(mem) || !in.get(size) || size < 0) return false;
+            chunks[i].mem = (char *)mem;
+            chunks[i].size = size;
+            // a chunk push had to release is left empty
+            if (chunks[i].mem ? !mMemory.contains(chunks[i].mem, size) : size)
+                return false;
+        }
+        if (count && (used < 0 || (size_t)used > chunks[current].size))
+            return false;
+        mChunks.swap(chunks);
+        mCurrent = current;
+        mUsed = used;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+//==--- GuestIO.h - Where GET reads from and PRINT writes to --------------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_GUEST_IO_H
+#define AST_INTERPRETER_GUEST_IO_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <functional>
+#include <vector>
+
+/// The input and output of a guest program, shared by both engines
+class GuestIO {
+   public:
+    virtual ~GuestIO() {}
+
+    /// GET
+    virtual long input() = 0;
+    /// PRINT
+    virtual void output(long value) = 0;
+    /// Make buffered output visible, called when the program ends
+    virtual void flush() {}
+};
+
+/// GET reads a number from in, prompting on out unless prompt is false, and
+/// PRINT writes a line to out
+class StreamIO : public GuestIO {
+    FILE *mIn;
+    FILE *mOut;
+    bool mPrompt;
+
+   public:
+    StreamIO(FILE *in, FILE *out, bool prompt = true)
+        : mIn(in), mOut(out), mPrompt(prompt) {}
+
+    virtual long input() {
+        long val = 0;
+        if (mPrompt) {
+            fputs("Please Input an Integer Value : ", mOut);
+            fflush(mOut);
+        }
+        if (fscanf(mIn, "%ld", &val) != 1) val = 0;
+        return val;
+    }
+
+    virtual void output(long value) { fprintf(mOut, "%ld\n", value); }
+
+    virtual void flush() { fflush(mOut); }
+};
+
+/// Non-interactive I/O for programs fed from files and pipes. GET never
+/// prompts and parses its values straight out of the input: a regular file
+/// is mapped whole, anything else is read in large chunks. PRINT formats
+/// into the fully buffered out, which is only flushed when its buffer fills,
+/// before blocking on more input and when the program ends.
+class FastIO : public GuestIO {
+    static const size_t kChunk = 1 << 16;
+
+    int mFd;
+    FILE *mOut;
+    char *mMap;  /// the whole input if it could be mapped
+    size_t mMapSize;
+    std::vector<char> mBuf;
+    const char *mPos;
+    const char *mEnd;
+
+   public:
+    /// Must be created before anything is written to out
+    FastIO(int fd, FILE *out)
+        : mFd(fd), mOut(out), mMap(NULL), mMapSize(0), mPos(NULL), mEnd(NULL) {
+        setvbuf(out, NULL, _IOFBF, kChunk);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                mMap = (char *)map;
+                mMapSize = st.st_size;
+                mPos = mMap;
+                mEnd = mMap + mMapSize;
+            }
+        }
+    }
+
+    virtual ~FastIO() {
+        flush();
+        if (mMap) munmap(mMap, mMapSize);
+    }
+
+    /// Like scanf("%ld"): 0 at the end of the input or if no number follows
+    virtual long input() {
+        int c;
+        while ((c = peek()) == ' ' || (c >= '\t' && c <= '\r')) mPos++;
+        bool negative = c == '-';
+        if (c == '-' || c == '+') mPos++;
+        unsigned long value = 0;
+        while ((c = peek()) >= '0' && c <= '9') {
+            value = value * 10 + (c - '0');
+            mPos++;
+        }
+        return negative ? -(long)value : (long)value;
+    }
+
+    virtual void output(long value) {
+        char buf[24];
+        char *end = buf + sizeof(buf);
+        char *p = end;
+        *--p = '\n';
+        unsigned long magnitude = value < 0 ? -(unsigned long)value : value;
+        do {
+            *--p = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude);
+        if (value < 0) *--p = '-';
+        fwrite(p, 1, end - p, mOut);
+    }
+
+    virtual void flush() { fflush(mOut); }
+
+   private:
+    int peek() {
+        if (mPos == mEnd && !refill()) return EOF;
+        return (unsigned char)*mPos;
+    }
+
+    /// Read the next chunk, false at the end of the input
+    bool refill() {
+        if (mMap) return false;
+        // whoever feeds the pipe may be waiting for the output so far
+        flush();
+        mBuf.resize(kChunk);
+        ssize_t n;
+        do {
+            n = read(mFd, &mBuf[0], kChunk);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return false;
+        mPos = &mBuf[0];
+        mEnd = mPos + n;
+        return true;
+    }
+};
+
+/// I/O of an embedded program: GET and PRINT call back into the host. A
+/// missing input callback reads 0, a missing output callback drops values.
+class CallbackIO : public GuestIO {
+   public:
+    typedef std::function<long()> Input;
+    typedef std::function<void(long)> Output;
+
+    CallbackIO(Input input, Output output)
+        : mInput(std::move(input)), mOutput(std::move(output)) {}
+
+    virtual long input() { return mInput ? mInput() : 0; }
+
+    virtual void output(long value) {
+        if (mOutput) mOutput(value);
+    }
+
+   private:
+    Input mInput;
+    Output mOutput;
+};
+
+/// Standard input, and standard error for the prompt and the output
+inline GuestIO *consoleIO() {
+    static StreamIO console(stdin, stderr);
+    return &console;
+}
+
+#endif
@@ -0,0 +1,363 @@
+//==--- GuestMemory.h - The address range all guest memory comes from -----===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_GUEST_MEMORY_H
+#define AST_INTERPRETER_GUEST_MEMORY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Snapshot.h"
+#include "ZeroPages.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/// The memory of one run of a guest program. Guest pointers are host
+/// addresses, so the heap, the frame arena and the global arrays all carve
+/// their blocks out of one range of address space reserved per Environment
+/// or VM. Everything the guest can point to then forms a single image,
+/// which a snapshot saves and maps back at the same address.
+///
+/// The range is reserved without access and committed from its start as
+/// allocations reach further; untouched pages read as zero and cost
+/// nothing. The reservation itself still counts against the address space
+/// limit (ulimit -v): under one, at most a quarter of it is reserved, and
+/// less if even that cannot be had, down to kMinReserve. Freed blocks
+/// become holes, coalesced with their neighbours and reused best fit. Freeing a block of ZeroPages::kThreshold bytes or more
+/// hands its pages back to the kernel. Owners of blocks never free them one
+/// by one when they go away: clear forgets every block at once.
+class GuestMemory {
+   public:
+    /// Address space reserved for the guest by default, 64 GiB, and the
+    /// least a reservation falls back to
+    static const size_t kDefaultReserve = 1UL << 36;
+    static const size_t kMinReserve = 64UL << 20;
+
+   private:
+    static const size_t kGranule = 16;
+    static const size_t kCommitStep = 64UL << 20;
+
+    size_t mReserve;    /// bytes of address space from mBase
+    char *mBase;
+    size_t mCommitted;  /// bytes from mBase that may be accessed
+    size_t mBreak;      /// end of the highest allocation
+    /// Free ranges below mBreak by offset, and the same ranges by size
+    std::map<size_t, size_t> mHoles;
+    std::multimap<size_t, size_t> mHolesBySize;
+
+   public:
+    /// Reserve bytes of address space, kDefaultReserve if 0
+    explicit GuestMemory(size_t bytes = 0)
+        : mReserve(initialReserve(bytes)),
+          mBase(NULL),
+          mCommitted(0),
+          mBreak(0),
+          mHoles(),
+          mHolesBySize() {
+        while (!(mBase = reserve(NULL)) && mReserve / 2 >= kMinReserve)
+            mReserve /= 2;
+        if (!mBase) {
+            fprintf(stderr, "Error: cannot reserve %zu bytes.\n", mReserve);
+            abort();
+        }
+    }
+    ~GuestMemory() { munmap(mBase, mReserve); }
+    GuestMemory(const GuestMemory &) = delete;
+    GuestMemory &operator=(const GuestMemory &) = delete;
+
+    /// bytes aligned on align, a power of two, not initialized. NULL once
+    /// the reserved range is exhausted.
+    char *allocate(size_t bytes, size_t align = kGranule) {
+        bytes = roundUp(std::max<size_t>(bytes, 1), kGranule);
+        if (align < kGranule) align = kGranule;
+        if (bytes > mReserve) return NULL;
+        size_t offset;
+        std::multimap<size_t, size_t>::iterator it =
+            mHolesBySize.lower_bound(bytes + align - kGranule);
+        if (it != mHolesBySize.end()) {
+            size_t start = it->second, size = it->first;
+            mHolesBySize.erase(it);
+            mHoles.erase(start);
+            offset = alignOffset(start, align);
+            if (offset > start) insertHole(start, offset - start);
+            if (start + size > offset + bytes)
+                insertHole(offset + bytes, start + size - offset - bytes);
+        } else {
+            offset = alignOffset(mBreak, align);
+            if (offset + bytes > mReserve || !commit(offset + bytes))
+                return NULL;
+            if (offset > mBreak) insertHole(mBreak, offset - mBreak);
+            mBreak = offset + bytes;
+        }
+        return mBase + offset;
+    }
+
+    /// Free bytes at mem, as returned by allocate
+    void release(char *mem, size_t bytes) {
+        bytes = roundUp(std::max<size_t>(bytes, 1), kGranule);
+        if (bytes >= ZeroPages::kThreshold) ZeroPages::release(mem, bytes);
+        size_t offset = mem - mBase;
+        std::map<size_t, size_t>::iterator next = mHoles.lower_bound(offset);
+        if (next != mHoles.end() && next->first == offset + bytes) {
+            bytes += next->second;
+            eraseHole(next);
+            next = mHoles.lower_bound(offset);
+        }
+        if (next != mHoles.begin()) {
+            std::map<size_t, size_t>::iterator prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                offset = prev->first;
+                bytes += prev->second;
+                eraseHole(prev);
+            }
+        }
+        if (offset + bytes == mBreak)
+            mBreak = offset;
+        else
+            insertHole(offset, bytes);
+    }
+
+    /// Whether bytes at mem lie below the break, as allocated blocks do
+    bool contains(const char *mem, size_t bytes) const {
+        return mem >= mBase && bytes <= mBreak &&
+               (size_t)(mem - mBase) <= mBreak - bytes;
+    }
+
+    /// Forget every block; their pages are handed back to the kernel
+    void clear() {
+        mHoles.clear();
+        mHolesBySize.clear();
+        mBreak = 0;
+        decommit(0);
+    }
+
+    //===------------------------------------------------------------------===//
+    // Snapshots. The metadata goes to the state of the snapshot, the pages
+    // up to the break to its image.
+    //===------------------------------------------------------------------===//
+
+    /// Bytes of the image, the allocated prefix of the range in whole pages
+    size_t imageBytes() const { return roundUp(mBreak, pageSize()); }
+
+    void save(SnapshotWriter &out) const {
+        out.put((long)mBase);
+        out.put(mBreak);
+        out.put(mHoles.size());
+        for (std::map<size_t, size_t>::const_iterator it = mHoles.begin();
+             it != mHoles.end(); ++it) {
+            out.put(it->first);
+            out.put(it->second);
+        }
+    }
+
+    /// Write the image to fd at offset, page aligned, leaving holes in the
+    /// file for the pages that are all zero
+    bool writeImage(int fd, off_t offset) const {
+        size_t page = pageSize(), image = imageBytes();
+        if (ftruncate(fd, offset + image) != 0) return false;
+        size_t start = 0;  /// first page of the run of nonzero pages
+        for (size_t at = 0; at <= image; at += page) {
+            if (at < image && !isZero(mBase + at, page)) continue;
+            if (start < at &&
+                !Snapshot::writeAll(fd, mBase + start, at - start,
+                                    offset + start))
+                return false;
+            start = at + page;
+        }
+        return true;
+    }
+
+    /// Replace the metadata by what save wrote, moving the range to the
+    /// address it was saved at if it lies elsewhere. False if the state is
+    /// damaged or that address is taken; the memory is then unchanged.
+    bool load(SnapshotReader &in) {
+        long base, brk, count;
+        if (!in.get(base) || !in.get(brk) || !in.get(count) || brk < 0 ||
+            (size_t)brk > mReserve || count < 0)
+            return false;
+        std::vector<std::pair<size_t, size_t> > holes;
+        for (long i = 0; i < count; i++) {
+            long offset, size;
+            if (!in.get(offset) || !in.get(size) || offset < 0 || size <= 0 ||
+                offset + size > brk)
+                return false;
+            holes.push_back(std::make_pair(offset, size));
+        }
+        if ((char *)base != mBase && !rebase((char *)base)) return false;
+        mHoles.clear();
+        mHolesBySize.clear();
+        for (unsigned i = 0; i < holes.size(); i++)
+            insertHole(holes[i].first, holes[i].second);
+        mBreak = brk;
+        return true;
+    }
+
+    /// Map bytes of the image at offset of fd over the range, copy on
+    /// write: a page is read from fd when the guest first touches it and
+    /// copied when it first writes it, so restoring costs nothing up front
+    /// and the pages only read are shared by every restore of the image
+    bool mapImage(int fd, off_t offset, size_t bytes) {
+        if (bytes != imageBytes()) return false;
+        if (bytes &&
+            mmap(mBase, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED)
+            return false;
+        if (mCommitted < bytes) mCommitted = bytes;
+        decommit(bytes);
+        return true;
+    }
+
+   private:
+    static size_t roundUp(size_t value, size_t align) {
+        return (value + align - 1) & ~(align - 1);
+    }
+
+    static size_t pageSize() { return sysconf(_SC_PAGESIZE); }
+
+    /// The first offset from offset on whose address is aligned on align
+    size_t alignOffset(size_t offset, size_t align) const {
+        return roundUp((size_t)mBase + offset, align) - (size_t)mBase;
+    }
+
+    static bool isZero(const char *mem, size_t bytes) {
+        const long *p = (const long *)mem;
+        for (size_t i = 0; i < bytes / sizeof(long); i++)
+            if (p[i]) return false;
+        return true;
+    }
+
+    /// bytes, or the default, capped at a quarter of the address space
+    /// limit if there is one, rounded to whole pages
+    static size_t initialReserve(size_t bytes) {
+        if (!bytes) bytes = kDefaultReserve;
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_AS, &limit) == 0 &&
+            limit.rlim_cur != RLIM_INFINITY)
+            bytes = std::min<size_t>(bytes, limit.rlim_cur / 4);
+        if (bytes < kMinReserve) bytes = kMinReserve;
+        return roundUp(bytes, pageSize());
+    }
+
+    /// mReserve bytes of address space without access, at base if it is not
+    /// NULL. NULL if they cannot be reserved there.
+    char *reserve(char *base) const {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+        if (base) flags |= MAP_FIXED_NOREPLACE;
+        void *mem = mmap(base, mReserve, PROT_NONE, flags, -1, 0);
+        if (mem == MAP_FAILED) return NULL;
+        // kernels before 4.17 take the address as a hint only
+        if (base && mem != base) {
+            munmap(mem, mReserve);
+            return NULL;
+        }
+        return (char *)mem;
+    }
+
+    /// Move the range to base, dropping its contents
+    bool rebase(char *base) {
+        char *mem = reserve(base);
+        if (!mem) return false;
+        munmap(mBase, mReserve);
+        mBase = mem;
+        mCommitted = 0;
+        return true;
+    }
+
+    /// Make the range accessible up to end
+    bool commit(size_t end) {
+        if (end <= mCommitted) return true;
+        size_t to = std::min(roundUp(end, kCommitStep), mReserve);
+        if (mmap(mBase + mCommitted, to - mCommitted, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1,
+                 0) == MAP_FAILED)
+            return false;
+        mCommitted = to;
+        return true;
+    }
+
+    /// Drop the pages from offset on and make them inaccessible again
+    void decommit(size_t offset) {
+        if (offset >= mCommitted) return;
+        mmap(mBase + offset, mCommitted - offset, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+        mCommitted = offset;
+    }
+
+    void insertHole(size_t offset, size_t size) {
+        mHoles[offset] = size;
+        mHolesBySize.insert(std::make_pair(size, offset));
+    }
+
+    void eraseHole(std::map<size_t, size_t>::iterator it) {
+        std::pair<std::multimap<size_t, size_t>::iterator,
+                  std::multimap<size_t, size_t>::iterator>
+            range = mHolesBySize.equal_range(it->second);
+        for (std::multimap<size_t, size_t>::iterator i = range.first;
+             i != range.second; ++i) {
+            if (i->second == it->first) {
+                mHolesBySize.erase(i);
+                break;
+            }
+        }
+        mHoles.erase(it);
+    }
+};
+
+/// Arrays living as long as the program, globals in particular, zero
+/// filled
+class StaticArrays {
+    GuestMemory &mMemory;
+    std::vector<std::pair<char *, size_t> > mArrays;
+
+   public:
+    explicit StaticArrays(GuestMemory &memory) : mMemory(memory), mArrays() {}
+    StaticArrays(const StaticArrays &) = delete;
+    StaticArrays &operator=(const StaticArrays &) = delete;
+
+    char *allocate(size_t bytes) {
+        char *mem = mMemory.allocate(bytes);
+        if (!mem) {
+            fprintf(stderr, "Error: cannot allocate %zu bytes.\n", bytes);
+            abort();
+        }
+        ZeroPages::zero(mem, bytes);
+        mArrays.push_back(std::make_pair(mem, bytes));
+        return mem;
+    }
+
+    /// Forget every array, once GuestMemory::clear has freed them
+    void clear() { mArrays.clear(); }
+
+    void save(SnapshotWriter &out) const {
+        out.put(mArrays.size());
+        for (unsigned i = 0; i < mArrays.size(); i++) {
+            out.put((long)mArrays[i].first);
+            out.put(mArrays[i].second);
+        }
+    }
+
+    bool load(SnapshotReader &in) {
+        long count;
+        if (!in.get(count) || count < 0) return false;
+        std::vector<std::pair<char *, size_t> > arrays;
+        for (long i = 0; i < count; i++) {
+            long mem, bytes;
+            if (!in.get(mem) || !in.get(bytes) || bytes < 0) return false;
+            arrays.push_back(std::make_pair((char *)mem, (size_t)bytes));
+        }
+        mArrays.swap(arrays);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,380 @@
+//==--- Heap.h - Guest heap with checked accesses -------------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_HEAP_H
+#define AST_INTERPRETER_HEAP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "GuestMemory.h"
+#include "Snapshot.h"
+#include "TypeLayout.h"
+
+/// Heap maps address to a value. Small blocks are carved out of size-class
+/// slabs with a bump pointer and per-slab free lists; larger ones come
+/// straight from the GuestMemory. Freed blocks are reclaimed, and slabs that
+/// become empty are handed back together with their metadata.
+class Heap {
+    static const int kSlabShift = 16;
+    static const long kSlabSize = 1L << kSlabShift;
+    static const int kMinClassShift = 4;  /// smallest cell is 16 bytes
+    static const int kNumClasses = 8;     /// largest cell is 2048 bytes
+    static const int kMaxSmall = 1 << (kMinClassShift + kNumClasses - 1);
+    static const unsigned short kFreeCell = 0xffff;
+
+    /// A slab of kSlabSize bytes, aligned on its size so the slab owning an
+    /// address is found by masking it
+    struct Slab {
+        char *mem;
+        unsigned cellSize;
+        unsigned numCells;
+        unsigned bump;   /// cells handed out by the bump pointer so far
+        unsigned live;   /// allocated cells
+        char *freeList;  /// freed cells, linked through their first word
+        bool available;  /// listed in the available slabs of its class
+        /// Requested size of every cell, kFreeCell when not allocated
+        std::vector<unsigned short> sizes;
+    };
+
+    struct SizeClass {
+        Slab *current;  /// slab allocations are served from
+        /// Other slabs with free cells
+        std::vector<Slab *> available;
+    };
+
+    GuestMemory &mMemory;
+    SizeClass mClasses[kNumClasses];
+    /// Slab base address to slab
+    std::unordered_map<long, Slab *> mSlabs;
+    /// Large blocks ordered by start address
+    std::map<long, int> block;
+    /// The large block found by the last successful check
+    long mLastStart = 0;
+    long mLastEnd = -1;
+
+    /// Statistics
+    long mLiveBlocks = 0;
+    long mLiveBytes = 0;  /// requested by live blocks
+    long mLargeBytes = 0;
+    long mMallocs = 0;
+    long mFrees = 0;
+
+   public:
+    explicit Heap(GuestMemory &memory) : mMemory(memory) {
+        for (int i = 0; i < kNumClasses; i++) mClasses[i].current = NULL;
+    }
+
+    /// The blocks themselves go with the GuestMemory
+    ~Heap() {
+        for (std::unordered_map<long, Slab *>::iterator it = mSlabs.begin();
+             it != mSlabs.end(); ++it)
+            delete it->second;
+    }
+
+    long *Malloc(int size) {
+        if (size < 0) {
+            printf("Error:Malloc invalid size:%d\n", size);
+            return NULL;
+        }
+        mMallocs++;
+        mLiveBlocks++;
+        mLiveBytes += size;
+        if (size > kMaxSmall) {
+            long *t = (long *)mMemory.allocate(size);
+            if (!t) return NULL;
+            block[(long)t] = size;
+            mLargeBytes += size;
+            return t;
+        }
+        return allocSmall(classOf(size), size);
+    }
+
+    void Free(long *addr) {
+        long a = (long)addr;
+        if (Slab *slab = slabOf(a)) {
+            long offset = a - (long)slab->mem;
+            unsigned index = offset / slab->cellSize;
+            if (offset % slab->cellSize != 0 ||
+                slab->sizes[index] == kFreeCell) {
+                printf("Error:Free invalid address:0x%p\n", addr);
+                return;
+            }
+            freeSmall(slab, index);
+            return;
+        }
+        std::map<long, int>::iterator it = block.find(a);
+        if (it == block.end()) {
+            printf("Error:Free invalid address:0x%p\n", addr);
+            return;
+        }
+        mFrees++;
+        mLiveBlocks--;
+        mLiveBytes -= it->second;
+        mLargeBytes -= it->second;
+        if (a == mLastStart) {
+            mLastStart = 0;
+            mLastEnd = -1;
+        }
+        mMemory.release((char *)addr, it->second);
+        block.erase(it);
+        //printf("free 0x%p.\n", addr);
+    }
+    /// Store and load a value of size bytes at addr
+    void Update(long *addr, long val, long size = sizeof(long)) {
+        bool valid = check(addr);
+        if (valid) {
+            TypeLayout::store(addr, size, val);
+            //printf("Update 0x%p to %ld.\n", addr, val);
+        } else
+            printf("Error:Update invalid address:0x%p\n", addr);
+    }
+    long Get(long *addr, long size = sizeof(long)) {
+        bool valid = check(addr);
+        if (valid) {
+            //printf("GET:0x%p,value:%ld.\n", addr, *addr);
+            return TypeLayout::load(addr, size);
+        } else {
+            printf("Error:Get value of invalid address:0x%p\n", addr);
+            return -1;
+        }
+    }
+    /// An address is valid if it lies within a live block or right at its
+    /// end. O(1) for slab blocks, O(log n) for large ones.
+    bool check(long *addr) {
+        long a = (long)addr;
+        if (Slab *slab = slabOf(a)) {
+            long offset = a - (long)slab->mem;
+            unsigned index = offset / slab->cellSize;
+            if (index < slab->numCells && slab->sizes[index] != kFreeCell &&
+                offset % slab->cellSize <= slab->sizes[index])
+                return true;
+            // one past the end of a block that fills its whole cell
+            return index > 0 && offset % slab->cellSize == 0 &&
+                   slab->sizes[index - 1] == slab->cellSize;
+        }
+        if (a >= mLastStart && a <= mLastEnd) return true;
+        std::map<long, int>::iterator iter = block.upper_bound(a);
+        if (iter == block.begin()) return false;
+        --iter;
+        if (a > iter->first + (long)iter->second) return false;
+        mLastStart = iter->first;
+        mLastEnd = iter->first + (long)iter->second;
+        return true;
+    }
+
+    /// Print allocation and fragmentation statistics
+    void report(FILE *out) {
+        long slabBytes = (long)mSlabs.size() * kSlabSize;
+        long cellBytes = 0;  /// bytes of the cells of live small blocks
+        long freeCellBytes = 0;
+        for (std::unordered_map<long, Slab *>::iterator it = mSlabs.begin();
+             it != mSlabs.end(); ++it) {
+            Slab *slab = it->second;
+            cellBytes += (long)slab->live * slab->cellSize;
+            freeCellBytes +=
+                (long)(slab->numCells - slab->live) * slab->cellSize;
+        }
+        long smallBytes = mLiveBytes - mLargeBytes;
+        fprintf(out, "Heap: %ld mallocs, %ld frees, %ld live blocks\n",
+                mMallocs, mFrees, mLiveBlocks);
+        fprintf(out,
+                "Heap: %ld bytes live, %ld in %zu large blocks, %ld in %zu "
+                "slabs of %ld bytes\n",
+                mLiveBytes, mLargeBytes, block.size(), smallBytes,
+                mSlabs.size(), kSlabSize);
+        fprintf(out,
+                "Heap: internal fragmentation %.1f%%, external fragmentation "
+                "%.1f%% (%ld free bytes in slabs)\n",
+                cellBytes ? 100.0 * (cellBytes - smallBytes) / cellBytes : 0.0,
+                slabBytes ? 100.0 * freeCellBytes / slabBytes : 0.0,
+                freeCellBytes);
+    }
+
+    /// Write the large blocks, the slabs and the state of every size class.
+    /// The blocks themselves are in the image of the GuestMemory.
+    void save(SnapshotWriter &out) const {
+        out.put(mLiveBlocks);
+        out.put(mLiveBytes);
+        out.put(mLargeBytes);
+        out.put(mMallocs);
+        out.put(mFrees);
+        out.put(block.size());
+        for (std::map<long, int>::const_iterator it = block.begin();
+             it != block.end(); ++it) {
+            out.put(it->first);
+            out.put(it->second);
+        }
+        out.put(mSlabs.size());
+        for (std::unordered_map<long, Slab *>::const_iterator it =
+                 mSlabs.begin();
+             it != mSlabs.end(); ++it) {
+            const Slab *slab = it->second;
+            out.put((long)slab->mem);
+            out.put(slab->cellSize);
+            out.put(slab->bump);
+            out.put(slab->live);
+            out.put((long)slab->freeList);
+            out.put(slab->available);
+            out.putBytes(slab->sizes.data(),
+                         slab->sizes.size() * sizeof(unsigned short));
+        }
+        for (int i = 0; i < kNumClasses; i++) {
+            const SizeClass &sc = mClasses[i];
+            out.put(sc.current ? (long)sc.current->mem : 0);
+            out.put(sc.available.size());
+            for (unsigned j = 0; j < sc.available.size(); j++)
+                out.put((long)sc.available[j]->mem);
+        }
+    }
+
+    /// Read what save wrote into a new Heap
+    bool load(SnapshotReader &in) {
+        long count;
+        if (!in.get(mLiveBlocks) || !in.get(mLiveBytes) ||
+            !in.get(mLargeBytes) || !in.get(mMallocs) || !in.get(mFrees) ||
+            !in.get(count) || count < 0)
+            return false;
+        for (long i = 0; i < count; i++) {
+            long start, size;
+            if (!in.get(start) || !in.get(size) || size <= kMaxSmall)
+                return false;
+            block[start] = size;
+        }
+        if (!in.get(count) || count < 0) return false;
+        for (long i = 0; i < count; i++) {
+            long mem, cellSize, bump, live, freeList, available;
+            if (!in.get(mem) || (mem & (kSlabSize - 1)) || !in.get(cellSize) ||
+                cellSize < (1 << kMinClassShift) || cellSize > kMaxSmall ||
+                (cellSize & (cellSize - 1)) || !in.get(bump) ||
+                !in.get(live) || !in.get(freeList) || !in.get(available))
+                return false;
+            Slab *slab = new Slab();
+            mSlabs[mem] = slab;
+            slab->mem = (char *)mem;
+            slab->cellSize = cellSize;
+            slab->numCells = kSlabSize / cellSize;
+            slab->bump = bump;
+            slab->live = live;
+            slab->freeList = (char *)freeList;
+            slab->available = available;
+            slab->sizes.resize(slab->numCells);
+            if (!in.getBytes(slab->sizes.data(),
+                             slab->numCells * sizeof(unsigned short)))
+                return false;
+        }
+        for (int i = 0; i < kNumClasses; i++) {
+            long current;
+            if (!in.get(current) || !in.get(count) || count < 0) return false;
+            mClasses[i].current = current ? slabOf(current) : NULL;
+            if (current && !mClasses[i].current) return false;
+            for (long j = 0; j < count; j++) {
+                long mem;
+                Slab *slab;
+                if (!in.get(mem) || !(slab = slabOf(mem))) return false;
+                mClasses[i].available.push_back(slab);
+            }
+        }
+        return true;
+    }
+
+   private:
+    static int classOf(int size) {
+        int cls = 0;
+        while ((1 << (kMinClassShift + cls)) < size) cls++;
+        return cls;
+    }
+
+    Slab *slabOf(long a) {
+        if (mSlabs.empty()) return NULL;
+        std::unordered_map<long, Slab *>::iterator it =
+            mSlabs.find(a & ~(kSlabSize - 1));
+        return it == mSlabs.end() ? NULL : it->second;
+    }
+
+    static bool hasRoom(Slab *slab) {
+        return slab->freeList || slab->bump < slab->numCells;
+    }
+
+    Slab *newSlab(int cls) {
+        char *mem = mMemory.allocate(kSlabSize, kSlabSize);
+        if (!mem) return NULL;
+        Slab *slab = new Slab();
+        slab->mem = mem;
+        slab->cellSize = 1 << (kMinClassShift + cls);
+        slab->numCells = kSlabSize / slab->cellSize;
+        slab->bump = 0;
+        slab->live = 0;
+        slab->freeList = NULL;
+        slab->available = false;
+        slab->sizes.assign(slab->numCells, (unsigned short)kFreeCell);
+        mSlabs[(long)mem] = slab;
+        return slab;
+    }
+
+    void releaseSlab(Slab *slab) {
+        if (slab->available) {
+            std::vector<Slab *> &avail =
+                mClasses[classOf(slab->cellSize)].available;
+            avail.erase(std::find(avail.begin(), avail.end(), slab));
+        }
+        mSlabs.erase((long)slab->mem);
+        mMemory.release(slab->mem, kSlabSize);
+        delete slab;
+    }
+
+    long *allocSmall(int cls, int size) {
+        SizeClass &sc = mClasses[cls];
+        Slab *slab = sc.current;
+        if (!slab || !hasRoom(slab)) {
+            slab = NULL;
+            while (!sc.available.empty()) {
+                Slab *candidate = sc.available.back();
+                sc.available.pop_back();
+                candidate->available = false;
+                if (hasRoom(candidate)) {
+                    slab = candidate;
+                    break;
+                }
+            }
+            if (!slab) slab = newSlab(cls);
+            if (!slab) return NULL;
+            sc.current = slab;
+        }
+        char *cell;
+        if (slab->freeList) {
+            cell = slab->freeList;
+            slab->freeList = *(char **)cell;
+        } else {
+            cell = slab->mem + (long)slab->bump++ * slab->cellSize;
+        }
+        slab->sizes[(cell - slab->mem) / slab->cellSize] = size;
+        slab->live++;
+        return (long *)cell;
+    }
+
+    void freeSmall(Slab *slab, unsigned index) {
+        mFrees++;
+        mLiveBlocks--;
+        mLiveBytes -= slab->sizes[index];
+        slab->sizes[index] = kFreeCell;
+        char *cell = slab->mem + (long)index * slab->cellSize;
+        *(char **)cell = slab->freeList;
+        slab->freeList = cell;
+        slab->live--;
+        SizeClass &sc = mClasses[classOf(slab->cellSize)];
+        if (slab == sc.current) return;
+        if (slab->live == 0) {
+            releaseSlab(slab);
+        } else if (!slab->available) {
+            slab->available = true;
+            sc.available.push_back(slab);
+        }
+    }
+};
+
+#endif
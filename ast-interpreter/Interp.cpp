@@ -0,0 +1,188 @@
+//==--- Interp.cpp - The interpreter as a library --------------------------===//
+//===----------------------------------------------------------------------===//
+#include "Interp.h"
+
+#include <map>
+
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Tooling/Tooling.h"
+#include "Environment.h"
+#include "GuestIO.h"
+#include "InterpreterVisitor.h"
+#include "Jit.h"
+#include "Snapshot.h"
+#include "StackBudget.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/MD5.h"
+
+namespace interp {
+
+struct Program::Impl {
+    std::unique_ptr<ASTUnit> ast;
+    /// MD5 of the source
+    std::string key;
+    /// Parameters of every function with a body
+    std::map<std::string, unsigned> arity;
+
+    TranslationUnitDecl *unit() const {
+        return ast->getASTContext().getTranslationUnitDecl();
+    }
+};
+
+Program::Program() : mImpl(new Impl()) {}
+
+Program::~Program() {}
+
+std::shared_ptr<const Program> Program::compile(const std::string &source) {
+    std::shared_ptr<Program> program(new Program());
+    program->mImpl->ast = clang::tooling::buildASTFromCode(source);
+    if (!program->mImpl->ast ||
+        program->mImpl->ast->getDiagnostics().hasErrorOccurred())
+        return std::shared_ptr<const Program>();
+    llvm::MD5 hash;
+    hash.update(source);
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    llvm::SmallString<32> hex;
+    llvm::MD5::stringifyResult(result, hex);
+    program->mImpl->key = hex.str().str();
+    TranslationUnitDecl *unit = program->mImpl->unit();
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                            e = unit->decls_end();
+         i != e; ++i) {
+        FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i);
+        if (fdecl && fdecl->doesThisDeclarationHaveABody())
+            program->mImpl->arity[fdecl->getNameAsString()] =
+                fdecl->getNumParams();
+    }
+    return program;
+}
+
+int Program::arity(const std::string &name) const {
+    std::map<std::string, unsigned>::const_iterator it =
+        mImpl->arity.find(name);
+    return it == mImpl->arity.end() ? -1 : (int)it->second;
+}
+
+const std::string &Program::key() const { return mImpl->key; }
+
+struct Snapshot::Impl {
+    std::unique_ptr<::Snapshot> snapshot;
+};
+
+Snapshot::Snapshot() : mImpl(new Impl()) {}
+
+Snapshot::~Snapshot() {}
+
+std::shared_ptr<const Snapshot> Snapshot::open(const std::string &path) {
+    std::shared_ptr<Snapshot> snapshot(new Snapshot());
+    snapshot->mImpl->snapshot = ::Snapshot::open(path);
+    if (!snapshot->mImpl->snapshot) return std::shared_ptr<const Snapshot>();
+    return snapshot;
+}
+
+/// The walker of one Instance over the shared AST. Everything it writes
+/// lives in its own Environment.
+struct Instance::Impl {
+    std::shared_ptr<const Program> program;
+    Options options;
+    Environment env;
+    InterpreterVisitor visitor;
+    std::unique_ptr<Jit> jit;
+    std::unique_ptr<CallbackIO> callbackIO;
+
+    Impl(std::shared_ptr<const Program> program, const Options &options)
+        : program(std::move(program)),
+          options(options),
+          env(options.memoryReserve),
+          visitor(&env) {}
+
+    /// Run fn with the walker bounded by the stack budget, if there is one
+    void guarded(const std::function<void()> &fn) {
+        if (!options.stackBudget) {
+            visitor.setStackLimit(NULL);
+            fn();
+            return;
+        }
+        StackBudget::run(options.stackBudget, [&](const char *limit) {
+            visitor.setStackLimit(limit);
+            fn();
+        });
+    }
+
+    void initGlobals() {
+        guarded([this]() {
+            for (unsigned i = 0; i < env.getGlobals().size(); i++)
+                visitor.declare(env.getGlobals()[i]);
+        });
+        env.flush();
+    }
+};
+
+Instance::Instance(std::shared_ptr<const Program> program,
+                   const Options &options)
+    : mImpl(new Impl(std::move(program), options)) {
+    mImpl->env.init(mImpl->program->mImpl->unit());
+    if (options.jitThreshold) {
+        mImpl->jit.reset(new Jit(mImpl->env, options.jitThreshold));
+        mImpl->visitor.setJit(mImpl->jit.get());
+    }
+    mImpl->initGlobals();
+}
+
+Instance::~Instance() {}
+
+void Instance::setIO(GuestIO *io) {
+    mImpl->env.setIO(io ? io : consoleIO());
+    mImpl->callbackIO.reset();
+}
+
+void Instance::setIO(std::function<long()> input,
+                     std::function<void(long)> output) {
+    std::unique_ptr<CallbackIO> io(
+        new CallbackIO(std::move(input), std::move(output)));
+    mImpl->env.setIO(io.get());
+    mImpl->callbackIO = std::move(io);
+}
+
+bool Instance::call(const std::string &name, const std::vector<long> &args,
+                    long &result) {
+    FunctionDecl *fdecl = mImpl->env.lookupFunction(name);
+    if (!fdecl || fdecl->getNumParams() != args.size()) return false;
+    bool halted = false;
+    mImpl->guarded([&]() {
+        result = mImpl->visitor.invoke(fdecl, args);
+        halted = mImpl->visitor.halted();
+    });
+    mImpl->env.flush();
+    return !halted;
+}
+
+void Instance::reset() {
+    mImpl->env.reset();
+    mImpl->initGlobals();
+}
+
+std::shared_ptr<const Snapshot> Instance::snapshot() {
+    std::shared_ptr<Snapshot> snapshot(new Snapshot());
+    snapshot->mImpl->snapshot =
+        mImpl->env.snapshot("", mImpl->program->key());
+    if (!snapshot->mImpl->snapshot) return std::shared_ptr<const Snapshot>();
+    return snapshot;
+}
+
+bool Instance::snapshot(const std::string &path) {
+    return mImpl->env.snapshot(path, mImpl->program->key()) != NULL;
+}
+
+bool Instance::restore(const Snapshot &snapshot) {
+    const ::Snapshot &saved = *snapshot.mImpl->snapshot;
+    // from a GET or PRINT callback, a call is still running
+    if (saved.key() != mImpl->program->key() || mImpl->env.depth() != 1)
+        return false;
+    if (mImpl->env.restore(saved)) return true;
+    reset();
+    return false;
+}
+
+}  // namespace interp
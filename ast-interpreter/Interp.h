@@ -0,0 +1,153 @@
+//==--- Interp.h - The interpreter as a library ----------------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_INTERP_H
+#define AST_INTERPRETER_INTERP_H
+
+#include <stddef.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class GuestIO;
+
+/// Embedding API of libinterp. A Program is parsed once and never changes,
+/// so one copy serves any number of Instances on any number of threads. An
+/// Instance holds the state of one run, its globals, heap and call stack,
+/// and calls guest functions by name:
+///
+///     std::shared_ptr<const interp::Program> program =
+///         interp::Program::compile(source);
+///     interp::Instance instance(program);
+///     long result;
+///     if (instance.call("fib", {30}, result)) ...
+///     instance.reset();
+///
+/// A Snapshot of an Instance saves its state between calls, and restoring
+/// it brings the Instance back to that state without rerunning anything.
+///
+/// Instances walk the AST, the way the interpreter runs by default.
+namespace interp {
+
+class Instance;
+class Snapshot;
+
+/// A parsed and analyzed guest program, immutable once compiled
+class Program {
+   public:
+    /// Parse source, NULL if it does not compile. The diagnostics are
+    /// printed on standard error.
+    static std::shared_ptr<const Program> compile(const std::string &source);
+
+    ~Program();
+    Program(const Program &) = delete;
+    Program &operator=(const Program &) = delete;
+
+    /// Number of parameters of the function called name, -1 if the program
+    /// defines no such function
+    int arity(const std::string &name) const;
+
+    /// Identifies the source, so snapshots are only restored into it
+    const std::string &key() const;
+
+   private:
+    struct Impl;
+    std::unique_ptr<Impl> mImpl;
+
+    Program();
+    friend class Instance;
+};
+
+/// The state of one run of a Program. Creating one resolves the program and
+/// runs the initializers of its globals; calls then share the globals and
+/// the heap until reset. An Instance must only be used by one thread at a
+/// time; different Instances of a Program are independent.
+class Instance {
+   public:
+    /// Initialized by a constructor rather than member initializers, which
+    /// the default argument below could not use inside Instance
+    struct Options {
+        /// Calls or loop iterations after which code is compiled, 0 disables
+        /// the JIT
+        unsigned jitThreshold;
+        /// Bytes the guest call stack may take. Calls recurse on the host
+        /// stack: with a budget every call runs on a thread with a stack of
+        /// that size, without one (0) on the calling thread, unchecked.
+        size_t stackBudget;
+        /// Address space reserved for guest memory, 0 for the default of
+        /// GuestMemory.h. A snapshot only restores into an Instance
+        /// reserving at least as much as the memory it saved.
+        size_t memoryReserve;
+
+        Options() : jitThreshold(0), stackBudget(0), memoryReserve(0) {}
+    };
+
+    explicit Instance(std::shared_ptr<const Program> program,
+                      const Options &options = Options());
+    ~Instance();
+    Instance(const Instance &) = delete;
+    Instance &operator=(const Instance &) = delete;
+
+    /// Read GET input from and write PRINT output to io, which must outlive
+    /// the calls; NULL restores the console
+    void setIO(GuestIO *io);
+    /// Call input for GET and output for PRINT
+    void setIO(std::function<long()> input, std::function<void(long)> output);
+
+    /// Call the function name with args and store what it returns in
+    /// result. False if the program defines no such function, if args do not
+    /// match its parameters, or if it exhausted the stack budget.
+    bool call(const std::string &name, const std::vector<long> &args,
+              long &result);
+
+    /// Return to the state of a new Instance: heap freed, globals
+    /// initialized again. What was resolved and compiled is kept.
+    void reset();
+
+    /// Save the globals, heap and arrays between calls, in memory or to
+    /// path; NULL or false if the snapshot cannot be written or a call is
+    /// running, as it is in a GET or PRINT callback. Capturing the frames
+    /// of a running call, with the point each one has reached, is not
+    /// supported.
+    std::shared_ptr<const Snapshot> snapshot();
+    bool snapshot(const std::string &path);
+
+    /// Return to the state saved in snapshot, without running anything. The
+    /// snapshot must be of the same program, and from this Instance or one
+    /// in another process: guest pointers are addresses, so the memory goes
+    /// back to where it was taken. False if it does not fit, in which case
+    /// the Instance is reset, unless the snapshot is of another program or
+    /// a call is running, which leave it alone.
+    bool restore(const Snapshot &snapshot);
+
+   private:
+    struct Impl;
+    std::unique_ptr<Impl> mImpl;
+};
+
+/// The state of an Instance at a point between calls. Restoring maps the
+/// saved memory back copy on write: pages are only read when touched and
+/// only copied when written, so an expensive setup runs once and every
+/// request starts from its result at the cost of the pages it changes.
+class Snapshot {
+   public:
+    /// Read a snapshot Instance::snapshot wrote to path, NULL if there is
+    /// none or it is damaged
+    static std::shared_ptr<const Snapshot> open(const std::string &path);
+
+    ~Snapshot();
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+   private:
+    struct Impl;
+    std::unique_ptr<Impl> mImpl;
+
+    Snapshot();
+    friend class Instance;
+};
+
+}  // namespace interp
+
+#endif
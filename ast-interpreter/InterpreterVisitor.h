@@ -0,0 +1,345 @@
+//==--- InterpreterVisitor.h - Statement and expression walker -----------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_INTERPRETER_VISITOR_H
+#define AST_INTERPRETER_INTERPRETER_VISITOR_H
+
+#include "clang/AST/StmtVisitor.h"
+#include "Environment.h"
+#include "Jit.h"
+#include "Profiler.h"
+#include "StackBudget.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace clang;
+
+/// How a statement completed. Anything but CC_Normal unwinds the enclosing
+/// statements up to the loop or function that handles it. CC_TailCall returns
+/// after the frame has been reused for the callee of a tail call.
+enum Completion {
+    CC_Normal = 0,
+    CC_Return,
+    CC_Break,
+    CC_Continue,
+    CC_TailCall
+};
+
+/// Executes statements and evaluates expressions. Exec runs a statement and
+/// returns its Completion; Eval returns the value of an expression and
+/// evaluates each child exactly once. Expressions are quickened: the first
+/// Eval records the resolved handler in the Environment's side table and later
+/// ones dispatch on it directly.
+class InterpreterVisitor : public StmtVisitor<InterpreterVisitor, long> {
+   public:
+    explicit InterpreterVisitor(Environment *env) : mEnv(env) {}
+    virtual ~InterpreterVisitor() {}
+
+    /// Hand hot functions and loops over to jit
+    void setJit(Jit *jit) {
+        mJit = jit;
+        if (jit) jit->setStackLimit(mStackLimit);
+    }
+
+    /// Count the calls and statements run in profiler
+    void setProfiler(Profiler *profiler) { mProfiler = profiler; }
+
+    /// Record the statement every frame runs, for the sampler
+    void setTrackPC(bool track) { mTrackPC = track; }
+
+    /// Stop the program once a call would take the host stack below limit
+    void setStackLimit(const char *limit) {
+        mStackLimit = limit;
+        if (mJit) mJit->setStackLimit(limit);
+    }
+
+    long Eval(Expr *e) {
+        const QuickInfo *q = mEnv->quicken(e);
+        switch (q->handler) {
+            case QuickInfo::Const:
+                return q->value;
+            case QuickInfo::Local:
+                return mEnv->local(q->value);
+            case QuickInfo::Global:
+                return mEnv->global(q->value);
+            case QuickInfo::Pass:
+                return Eval(q->lhs);
+            case QuickInfo::Binary: {
+                long vall = Eval(q->lhs);
+                long valr = Eval(q->rhs);
+                return mEnv->arith(q, vall, valr);
+            }
+            case QuickInfo::Builtin:
+            case QuickInfo::Call:
+                return call(cast<CallExpr>(e), q);
+            default:
+                return StmtVisitor::Visit(e);
+        }
+    }
+
+    /// Execute a statement and report how it completed
+    Completion Exec(Stmt *stmt) {
+        if (mHalted) return CC_Return;
+        if (mProfiler) mProfiler->statement(stmt);
+        if (mTrackPC) mEnv->setPC(stmt);
+        if (Expr *e = dyn_cast<Expr>(stmt)) {
+            Eval(e);
+            return CC_Normal;
+        }
+        return (Completion)StmtVisitor::Visit(stmt);
+    }
+
+    virtual long VisitCompoundStmt(CompoundStmt *cstmt) {
+        for (CompoundStmt::body_iterator it = cstmt->body_begin(),
+                                         ie = cstmt->body_end();
+             it != ie; ++it) {
+            Completion c = Exec(*it);
+            if (c != CC_Normal) return c;
+        }
+        return CC_Normal;
+    }
+
+    virtual long VisitWhileStmt(WhileStmt *whilestmt) {
+        Expr *cond = whilestmt->getCond();
+        Stmt *body = whilestmt->getBody();
+        LoopCounter *counter = mJit ? mEnv->loopCounter(whilestmt) : NULL;
+        if (counter && counter->native) return nativeLoop(counter);
+        while (Eval(cond) != 0) {
+            Completion c = Exec(body);
+            if (c == CC_Break) break;
+            if (c == CC_Return || c == CC_TailCall) return c;
+            if (counter && mJit->backEdge(whilestmt, counter))
+                return nativeLoop(counter);
+        }
+        return CC_Normal;
+    }
+
+    virtual long VisitForStmt(ForStmt *forstmt) {
+        Stmt *initstmt = forstmt->getInit();
+        if (initstmt) Exec(initstmt);
+        Expr *cond = forstmt->getCond();
+        Expr *inc = forstmt->getInc();
+        Stmt *body = forstmt->getBody();
+        LoopCounter *counter = mJit ? mEnv->loopCounter(forstmt) : NULL;
+        if (counter && counter->native) return nativeLoop(counter);
+        while (!cond || Eval(cond) != 0) {
+            Completion c = Exec(body);
+            if (c == CC_Break) break;
+            if (c == CC_Return || c == CC_TailCall) return c;
+            if (inc) Eval(inc);
+            if (counter && mJit->backEdge(forstmt, counter))
+                return nativeLoop(counter);
+        }
+        return CC_Normal;
+    }
+
+    virtual long VisitIfStmt(IfStmt *ifstmt) {
+        Stmt *taken;
+        if (mEnv->prunedIf(ifstmt, taken))
+            return taken ? Exec(taken) : CC_Normal;
+        if (Eval(ifstmt->getCond()) != 0) {
+            return Exec(ifstmt->getThen());
+        } else if (ifstmt->getElse()) {
+            return Exec(ifstmt->getElse());
+        }
+        return CC_Normal;
+    }
+
+    virtual long VisitBreakStmt(BreakStmt *bstmt) { return CC_Break; }
+
+    virtual long VisitContinueStmt(ContinueStmt *cstmt) { return CC_Continue; }
+
+    /// Only assignments get here, arithmetic is quickened
+    virtual long VisitBinaryOperator(BinaryOperator *bop) {
+        if (!bop->isAssignmentOp()) return 0;
+        long val = Eval(bop->getRHS());
+        Expr *left = bop->getLHS();
+        if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(left)) {
+            mEnv->assignVar(declexpr, val);
+        } else if (ArraySubscriptExpr *aexpr =
+                       dyn_cast<ArraySubscriptExpr>(left)) {
+            long index = Eval(aexpr->getIdx());
+            long base = Eval(aexpr->getBase());
+            mEnv->assignElement(aexpr, base, index, val);
+        } else if (UnaryOperator *uope = dyn_cast<UnaryOperator>(left)) {
+            mEnv->assignDeref(uope, Eval(uope->getSubExpr()), val);
+        } else {
+            printf("shouldn't be here\n");
+        }
+        return val;
+    }
+
+    virtual long VisitUnaryOperator(UnaryOperator *uop) {
+        return mEnv->unaryop(uop, Eval(uop->getSubExpr()));
+    }
+
+    virtual long VisitArraySubscriptExpr(ArraySubscriptExpr *expr) {
+        long base = Eval(expr->getBase());
+        long index = Eval(expr->getIdx());
+        return mEnv->arrayref(expr, base, index);
+    }
+
+    virtual long VisitReturnStmt(ReturnStmt *rets) {
+        if (CallExpr *tail = mEnv->tailCall(rets)) {
+            const QuickInfo *q = mEnv->quicken(tail);
+            llvm::SmallVector<long, 8> args;
+            for (unsigned i = 0; i < tail->getNumArgs(); i++)
+                args.push_back(Eval(tail->getArg(i)));
+            mEnv->reuseFrame(tail, q, args);
+            if (mProfiler) mProfiler->tailCall(q->callee);
+            mTailBody = q->body;
+            return CC_TailCall;
+        }
+        Expr *rexpr = rets->getRetValue();
+        mEnv->retstmt(rexpr ? Eval(rexpr) : 0);
+        return CC_Return;
+    }
+
+    long call(CallExpr *callexpr, const QuickInfo *q) {
+        if (mHalted) return halt();
+        if (q->handler == QuickInfo::Builtin) {
+            llvm::SmallVector<long, 1> args;
+            for (unsigned i = 0; i < callexpr->getNumArgs(); i++)
+                args.push_back(Eval(callexpr->getArg(i)));
+            // an argument may have halted the program: PRINT(f()) must not
+            // print what f returned after its stack ran out
+            if (mHalted) return halt();
+            return mEnv->builtin(callexpr, q, args);
+        }
+        if (StackBudget::exceeded(mStackLimit)) return halt();
+        if (mProfiler) return profiledCall(callexpr, q);
+        if (q->memo) return memoCall(callexpr, q);
+        if (mJit && mJit->call(q->callee, q->counter))
+            return nativeCall(callexpr, q);
+        // parameters occupy the first slots of the callee frame; arguments
+        // are evaluated straight into them
+        unsigned base = mEnv->call(callexpr, q);
+        for (unsigned i = 0; i < callexpr->getNumArgs(); i++)
+            mEnv->bindArg(base, i, Eval(callexpr->getArg(i)));
+        mEnv->enter(base);
+        run(q->body);
+        // return here
+        return mEnv->ret(callexpr);
+    }
+
+    /// Call a guest function on the profiler's shadow stack. Arguments are
+    /// evaluated before the callee is entered, as without the profiler.
+    long profiledCall(CallExpr *callexpr, const QuickInfo *q) {
+        llvm::SmallVector<long, 8> args;
+        for (unsigned i = 0; i < callexpr->getNumArgs(); i++)
+            args.push_back(Eval(callexpr->getArg(i)));
+        mProfiler->enter(q->callee);
+        long val;
+        if (!q->memo || !mEnv->memoLookup(q, args, val)) {
+            unsigned base = mEnv->call(callexpr, q);
+            for (unsigned i = 0; i < args.size(); i++)
+                mEnv->bindArg(base, i, args[i]);
+            mEnv->enter(base);
+            run(q->body);
+            val = mEnv->ret(callexpr);
+            if (q->memo && !mHalted) mEnv->memoInsert(q, args, val);
+        }
+        mProfiler->exit();
+        return val;
+    }
+
+    /// Call a pure function, running it only if the cache has no result for
+    /// its arguments
+    long memoCall(CallExpr *callexpr, const QuickInfo *q) {
+        llvm::SmallVector<long, 8> args;
+        for (unsigned i = 0; i < callexpr->getNumArgs(); i++)
+            args.push_back(Eval(callexpr->getArg(i)));
+        long val;
+        if (mEnv->memoLookup(q, args, val)) return val;
+        unsigned base = mEnv->call(callexpr, q);
+        for (unsigned i = 0; i < args.size(); i++)
+            mEnv->bindArg(base, i, args[i]);
+        mEnv->enter(base);
+        run(q->body);
+        val = mEnv->ret(callexpr);
+        if (!mHalted) mEnv->memoInsert(q, args, val);
+        return val;
+    }
+
+    long nativeCall(CallExpr *callexpr, const QuickInfo *q) {
+        llvm::SmallVector<long, 8> args;
+        for (unsigned i = 0; i < callexpr->getNumArgs(); i++)
+            args.push_back(Eval(callexpr->getArg(i)));
+        long val = q->counter->native(args.data());
+        if (mJit->overflowed()) return halt();
+        return val;
+    }
+
+    /// Stop the program: every pending call returns 0 and every statement
+    /// completes as a return, unwinding the walker back to main
+    long halt() {
+        if (!mHalted) {
+            mEnv->flush();
+            llvm::errs() << "Error: guest call stack exceeds its budget at "
+                            "depth "
+                         << mEnv->depth() << ".\n";
+            mHalted = true;
+        }
+        return 0;
+    }
+
+    /// Run the rest of a loop natively on the current frame
+    long nativeLoop(LoopCounter *counter) {
+        long rval = 0;
+        int completion = counter->native(mEnv->frame(), &rval);
+        // a call of the loop ran out of stack and unwound it as a return
+        if (mJit->overflowed()) halt();
+        if (completion == 0) return CC_Normal;
+        mEnv->retstmt(rval);
+        return CC_Return;
+    }
+
+    virtual long VisitDeclStmt(DeclStmt *declstmt) {
+        for (DeclStmt::decl_iterator it = declstmt->decl_begin(),
+                                     ie = declstmt->decl_end();
+             it != ie; ++it) {
+            if (VarDecl *vdecl = dyn_cast<VarDecl>(*it)) declare(vdecl);
+        }
+        return CC_Normal;
+    }
+
+    /// Run a function body in the current frame, following tail calls without
+    /// growing the host stack
+    void run(Stmt *body) {
+        while (body && Exec(body) == CC_TailCall) body = mTailBody;
+    }
+
+    /// Call fdecl, a function with a body, with args from outside the
+    /// program: on a frame above the current one, which it returns to.
+    /// Clears a previous halt; check halted() before trusting the result.
+    long invoke(FunctionDecl *fdecl, llvm::ArrayRef<long> args) {
+        mHalted = false;
+        if (mJit) mJit->clearOverflow();
+        unsigned size = std::max<unsigned>(mEnv->frameSize(fdecl), args.size());
+        unsigned base = mEnv->reserveFrame(size, args.size());
+        for (unsigned i = 0; i < args.size(); i++)
+            mEnv->bindArg(base, i, args[i]);
+        mEnv->enter(base);
+        run(fdecl->getBody());
+        return mEnv->ret(NULL);
+    }
+
+    /// True if the program was stopped since the last invoke
+    bool halted() const { return mHalted; }
+
+    /// Evaluate the initializer of vdecl and bind the variable
+    void declare(VarDecl *vdecl) {
+        long init = vdecl->hasInit() ? Eval(vdecl->getInit()) : 0;
+        mEnv->vardecl(vdecl, init);
+    }
+
+   private:
+    Environment *mEnv;
+    Jit *mJit = NULL;
+    Profiler *mProfiler = NULL;
+    bool mTrackPC = false;
+    const char *mStackLimit = NULL;
+    bool mHalted = false;
+    /// Body of the callee of the pending tail call
+    Stmt *mTailBody = NULL;
+};
+
+#endif
@@ -0,0 +1,836 @@
+//==--- Jit.h - Native tier compiling hot guest code with LLVM ORC --------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_JIT_H
+#define AST_INTERPRETER_JIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ConstantFolder.h"
+#include "Environment.h"
+#include "TypeLayout.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+
+/// Compiles guest functions and loops the walker found hot to native code.
+///
+/// Bodies are lowered from the AST to LLVM IR with the semantics of the
+/// walker and compiled with ORC. Compiled code keeps the frame layout of the
+/// walker: a function receives its arguments in the order of its parameter
+/// slots, and a loop runs directly on the slots of the frame it was entered
+/// from, so the walker can hand a loop over in the middle of its execution.
+/// Slots are copied into SSA values on entry (and back on exit for loops),
+/// since guest code cannot take the address of a variable. Heap accesses
+/// through pointers and the built-in functions call back into the
+/// Environment. Guest functions called from compiled code are compiled along
+/// with it; if one of them cannot be lowered, the code stays interpreted.
+///
+/// Calls between compiled functions recurse on the host stack like the
+/// walker's, so compiled functions check the stack limit of the walker on
+/// entry. Once it is exceeded every compiled frame returns 0 up to the
+/// walker, which then stops the program as it does on its own overflow.
+class Jit {
+    Environment &mEnv;
+    unsigned mThreshold;
+    std::unique_ptr<llvm::orc::LLJIT> mJIT;
+
+    /// Statistics
+    unsigned mModules = 0;
+    unsigned mFunctions = 0;
+    unsigned mLoops = 0;
+    unsigned mFailures = 0;
+
+    /// Lowest stack address compiled calls may reach, NULL if unchecked,
+    /// and whether compiled code stopped on it. Compiled code reads and
+    /// writes both through their addresses.
+    const char *mStackLimit = NULL;
+    bool mOverflowed = false;
+
+    /// State of the module being built
+    std::unique_ptr<llvm::LLVMContext> mContext;
+    std::unique_ptr<llvm::Module> mModule;
+    std::unique_ptr<llvm::IRBuilder<> > mB;
+    llvm::Type *mInt64;
+    llvm::FunctionType *mFunctionType;  /// i64 (i64 *args)
+    llvm::FunctionType *mLoopType;      /// i32 (i64 *fp, i64 *ret)
+    llvm::DenseMap<const FunctionDecl *, llvm::Function *> mDeclared;
+    std::vector<FunctionDecl *> mWorklist;
+    /// Guest functions of the module and the name of their code
+    std::vector<std::pair<FunctionDecl *, std::string> > mCompiled;
+    bool mFailed;
+
+    /// State of the function being lowered
+    llvm::Function *mFn;
+    llvm::BasicBlock *mEntry;  /// allocas and slot loads, jumps to mBody
+    llvm::BasicBlock *mBody;
+    llvm::BasicBlock *mExit;
+    llvm::Value *mIncoming;    /// the argument or frame pointer
+    unsigned mNumParams;
+    bool mLoopMode;
+    const FunctionDecl *mFunction;  /// function mode only
+    /// Function mode only, where self tail calls leave their arguments and
+    /// the block that rebinds the slots to them, NULL until one is lowered
+    llvm::AllocaInst *mTailArgs;
+    llvm::BasicBlock *mRecur;
+    llvm::DenseMap<unsigned, llvm::AllocaInst *> mSlots;
+    llvm::AllocaInst *mRetVal;
+    llvm::AllocaInst *mCompletion;  /// loop mode only, 1 once returned
+    /// Function mode only, the block of local arrays pushed on the arena of
+    /// the Environment on entry, NULL if the function declares none
+    llvm::Value *mArrays;
+    /// Break and continue targets of the enclosing loops
+    llvm::SmallVector<std::pair<llvm::BasicBlock *, llvm::BasicBlock *>, 4>
+        mLoopTargets;
+
+   public:
+    Jit(Environment &env, unsigned threshold)
+        : mEnv(env), mThreshold(threshold) {
+        // the daemon creates one Jit per request, concurrently
+        static std::once_flag targetsReady;
+        std::call_once(targetsReady, [] {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+        });
+        llvm::Expected<std::unique_ptr<llvm::orc::LLJIT> > jit =
+            llvm::orc::LLJITBuilder().create();
+        if (!jit) {
+            llvm::errs() << "JIT: " << llvm::toString(jit.takeError())
+                         << ", staying in the interpreter.\n";
+            return;
+        }
+        mJIT = std::move(*jit);
+    }
+
+    /// Count a call of fdecl. Returns true once it has native code.
+    bool call(FunctionDecl *fdecl, FunctionCounter *counter) {
+        if (counter->native) return true;
+        if (counter->failed || ++counter->calls < mThreshold) return false;
+        return compileFunction(fdecl, counter);
+    }
+
+    /// Count an iteration of loop. Returns true once it has native code.
+    bool backEdge(Stmt *loop, LoopCounter *counter) {
+        if (counter->native) return true;
+        if (counter->failed || ++counter->iterations < mThreshold)
+            return false;
+        return compileLoop(loop, counter);
+    }
+
+    /// Stop compiled calls once the stack grows past limit (StackBudget)
+    void setStackLimit(const char *limit) { mStackLimit = limit; }
+
+    /// True once compiled code ran out of stack, until clearOverflow
+    bool overflowed() const { return mOverflowed; }
+    void clearOverflow() { mOverflowed = false; }
+
+    void report(FILE *out) {
+        fprintf(out,
+                "JIT: %u functions and %u loops compiled in %u modules, %u "
+                "failed\n",
+                mFunctions, mLoops, mModules, mFailures);
+    }
+
+   private:
+    //===------------------------------------------------------------------===//
+    // Runtime callbacks of compiled code
+    //===------------------------------------------------------------------===//
+
+    static long rtLoad(Environment *env, long addr, long size) {
+        return env->getHeap()->Get((long *)addr, size);
+    }
+    static void rtStore(Environment *env, long addr, long val, long size) {
+        env->getHeap()->Update((long *)addr, val, size);
+    }
+    static long rtMalloc(Environment *env, long size) {
+        return (long)env->getHeap()->Malloc(size);
+    }
+    static void rtFree(Environment *env, long addr) {
+        env->getHeap()->Free((long *)addr);
+    }
+    static long rtInput(Environment *env) { return env->input(); }
+    static void rtOutput(Environment *env, long val) { env->output(val); }
+    static long rtPushArrays(Environment *env, long bytes) {
+        return (long)env->getArena().push(bytes);
+    }
+    static void rtPopArrays(Environment *env, long arrays) {
+        env->getArena().pop((char *)arrays);
+    }
+    static void rtZero(long array, long bytes) {
+        ZeroPages::zero((char *)array, bytes);
+    }
+    static long rtLocalArray(Environment *env, VarDecl *vdecl) {
+        return (long)env->localArray(vdecl);
+    }
+
+    //===------------------------------------------------------------------===//
+    // Driver
+    //===------------------------------------------------------------------===//
+
+    bool compileFunction(FunctionDecl *fdecl, FunctionCounter *counter) {
+        if (!mJIT) {
+            counter->failed = true;
+            return false;
+        }
+        beginModule();
+        declare(fdecl);
+        if (!lowerPending() || !emitModule()) {
+            counter->failed = true;
+            mFailures++;
+            return false;
+        }
+        return counter->native != NULL;
+    }
+
+    bool compileLoop(Stmt *loop, LoopCounter *counter) {
+        if (!mJIT) {
+            counter->failed = true;
+            return false;
+        }
+        beginModule();
+        std::string name = "loop." + std::to_string(mModules);
+        mFn = llvm::Function::Create(mLoopType,
+                                     llvm::Function::ExternalLinkage, name,
+                                     mModule.get());
+        beginBody(mFn->arg_begin(), 0, true);
+        lowerLoop(loop, false);
+        endBody();
+        if (!lowerPending() || !emitModule()) {
+            counter->failed = true;
+            mFailures++;
+            return false;
+        }
+        llvm::Expected<llvm::JITEvaluatedSymbol> sym = mJIT->lookup(name);
+        if (!sym) {
+            llvm::consumeError(sym.takeError());
+            counter->failed = true;
+            mFailures++;
+            return false;
+        }
+        counter->native = (int (*)(long *, long *))sym->getAddress();
+        mLoops++;
+        return true;
+    }
+
+    void beginModule() {
+        mModules++;
+        // a module that failed to lower still refers to the old context
+        mB.reset();
+        mModule.reset();
+        mContext.reset(new llvm::LLVMContext());
+        mModule.reset(new llvm::Module("guest", *mContext));
+        mModule->setDataLayout(mJIT->getDataLayout());
+        mModule->setTargetTriple(llvm::sys::getProcessTriple());
+        mB.reset(new llvm::IRBuilder<>(*mContext));
+        mInt64 = llvm::Type::getInt64Ty(*mContext);
+        llvm::Type *ptr = mInt64->getPointerTo();
+        mFunctionType = llvm::FunctionType::get(mInt64, {ptr}, false);
+        mLoopType = llvm::FunctionType::get(llvm::Type::getInt32Ty(*mContext),
+                                            {ptr, ptr}, false);
+        mDeclared.clear();
+        mWorklist.clear();
+        mCompiled.clear();
+        mFailed = false;
+    }
+
+    /// The code of a guest function lowered into this module
+    llvm::Function *declare(FunctionDecl *fdecl) {
+        llvm::Function *&fn = mDeclared[fdecl->getCanonicalDecl()];
+        if (!fn) {
+            std::string name = "guest." + fdecl->getNameAsString() + "." +
+                               std::to_string(mModules);
+            fn = llvm::Function::Create(mFunctionType,
+                                        llvm::Function::ExternalLinkage,
+                                        name, mModule.get());
+            mWorklist.push_back(fdecl);
+            mCompiled.push_back(std::make_pair(fdecl, name));
+        }
+        return fn;
+    }
+
+    /// Lower the functions declared so far and those they call
+    bool lowerPending() {
+        while (!mFailed && !mWorklist.empty()) {
+            FunctionDecl *fdecl = mWorklist.back();
+            mWorklist.pop_back();
+            const FunctionDecl *definition = NULL;
+            if (!fdecl->hasBody(definition)) {
+                mFailed = true;
+                break;
+            }
+            mFn = mDeclared[fdecl->getCanonicalDecl()];
+            beginBody(mFn->arg_begin(), definition->getNumParams(), false);
+            mFunction = definition;
+            if (long bytes = mEnv.arrayBytes(definition))
+                mArrays = runtime((void *)&rtPushArrays, mInt64,
+                                  {envPtr(), mB->getInt64(bytes)});
+            stmt(definition->getBody());
+            endBody();
+            if (mFailed) mEnv.functionCounter(fdecl)->failed = true;
+        }
+        return !mFailed;
+    }
+
+    /// Verify, optimize and hand the module to ORC, then publish the code of
+    /// its guest functions
+    bool emitModule() {
+        if (llvm::verifyModule(*mModule, &llvm::errs())) return false;
+        optimize(*mModule);
+        llvm::Error err = mJIT->addIRModule(llvm::orc::ThreadSafeModule(
+            std::move(mModule), std::move(mContext)));
+        if (err) {
+            llvm::errs() << "JIT: " << llvm::toString(std::move(err)) << "\n";
+            return false;
+        }
+        for (unsigned i = 0; i < mCompiled.size(); i++) {
+            llvm::Expected<llvm::JITEvaluatedSymbol> sym =
+                mJIT->lookup(mCompiled[i].second);
+            if (!sym) {
+                llvm::consumeError(sym.takeError());
+                return false;
+            }
+            mEnv.functionCounter(mCompiled[i].first)->native =
+                (long (*)(const long *))sym->getAddress();
+            mFunctions++;
+        }
+        return true;
+    }
+
+    void optimize(llvm::Module &module) {
+        llvm::PassBuilder builder;
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cgam;
+        llvm::ModuleAnalysisManager mam;
+        builder.registerModuleAnalyses(mam);
+        builder.registerCGSCCAnalyses(cgam);
+        builder.registerFunctionAnalyses(fam);
+        builder.registerLoopAnalyses(lam);
+        builder.crossRegisterProxies(lam, fam, cgam, mam);
+        llvm::ModulePassManager mpm = builder.buildPerModuleDefaultPipeline(
+            llvm::PassBuilder::OptimizationLevel::O2);
+        mpm.run(module, mam);
+    }
+
+    void unsupported() { mFailed = true; }
+
+    //===------------------------------------------------------------------===//
+    // Function bodies
+    //===------------------------------------------------------------------===//
+
+    /// Start lowering into mFn. incoming points to the arguments of a guest
+    /// function, or to the frame slots in loop mode.
+    void beginBody(llvm::Value *incoming, unsigned numParams, bool loopMode) {
+        mIncoming = incoming;
+        mNumParams = numParams;
+        mLoopMode = loopMode;
+        mSlots.clear();
+        mLoopTargets.clear();
+        mEntry = llvm::BasicBlock::Create(*mContext, "entry", mFn);
+        mExit = llvm::BasicBlock::Create(*mContext, "exit", mFn);
+        mB->SetInsertPoint(mEntry);
+        mRetVal = mB->CreateAlloca(mInt64);
+        mB->CreateStore(mB->getInt64(0), mRetVal);
+        mCompletion = NULL;
+        mArrays = NULL;
+        mFunction = NULL;
+        mTailArgs = NULL;
+        mRecur = NULL;
+        if (loopMode) {
+            mCompletion = mB->CreateAlloca(mB->getInt32Ty());
+            mB->CreateStore(mB->getInt32(0), mCompletion);
+        }
+        mBody = newBlock("body");
+        mB->SetInsertPoint(mBody);
+        if (!loopMode) checkStack();
+    }
+
+    /// Return 0 without running the function if the stack has grown past
+    /// the limit. Nothing is set up yet, so no cleanup is needed.
+    void checkStack() {
+        llvm::Function *stacksave = llvm::Intrinsic::getDeclaration(
+            mModule.get(), llvm::Intrinsic::stacksave);
+        llvm::Value *sp =
+            mB->CreatePtrToInt(mB->CreateCall(stacksave), mInt64);
+        llvm::Value *limit = mB->CreateLoad(mInt64, constPtr(&mStackLimit));
+        llvm::BasicBlock *overflowBB = newBlock("overflow");
+        llvm::BasicBlock *contBB = newBlock("cont");
+        mB->CreateCondBr(mB->CreateICmpULT(sp, limit), overflowBB, contBB);
+        mB->SetInsertPoint(overflowBB);
+        mB->CreateStore(mB->getInt8(1), overflowedPtr());
+        mB->CreateRet(mB->getInt64(0));
+        mB->SetInsertPoint(contBB);
+    }
+
+    /// Leave through mExit, returning 0, if the callee ran out of stack
+    void unwindIfOverflowed() {
+        llvm::Value *overflowed = mB->CreateICmpNE(
+            mB->CreateLoad(mB->getInt8Ty(), overflowedPtr()), mB->getInt8(0));
+        llvm::BasicBlock *unwindBB = newBlock("unwind");
+        llvm::BasicBlock *contBB = newBlock("cont");
+        mB->CreateCondBr(overflowed, unwindBB, contBB);
+        mB->SetInsertPoint(unwindBB);
+        mB->CreateStore(mB->getInt64(0), mRetVal);
+        if (mLoopMode) mB->CreateStore(mB->getInt32(1), mCompletion);
+        mB->CreateBr(mExit);
+        mB->SetInsertPoint(contBB);
+    }
+
+    llvm::Value *overflowedPtr() {
+        return llvm::ConstantExpr::getIntToPtr(
+            mB->getInt64((uint64_t)&mOverflowed), mB->getInt8PtrTy());
+    }
+
+    void endBody() {
+        branch(mExit);
+        if (mRecur) {
+            // a fresh frame like Environment::reuseFrame, then the body again
+            mB->SetInsertPoint(mRecur);
+            for (llvm::DenseMap<unsigned, llvm::AllocaInst *>::iterator
+                     it = mSlots.begin();
+                 it != mSlots.end(); ++it) {
+                llvm::Value *init = mB->getInt64(0);
+                if (it->first < mNumParams)
+                    init = mB->CreateLoad(
+                        mInt64, mB->CreateGEP(mInt64, mTailArgs,
+                                              mB->getInt64(it->first)));
+                mB->CreateStore(init, it->second);
+            }
+            mB->CreateBr(mBody);
+        }
+        mB->SetInsertPoint(mEntry);
+        mB->CreateBr(mBody);
+        mB->SetInsertPoint(mExit);
+        if (!mLoopMode) {
+            if (mArrays)
+                runtime((void *)&rtPopArrays, mB->getVoidTy(),
+                        {envPtr(), mArrays});
+            mB->CreateRet(mB->CreateLoad(mInt64, mRetVal));
+            return;
+        }
+        // hand the slots back to the walker
+        llvm::Value *fp = mIncoming;
+        for (llvm::DenseMap<unsigned, llvm::AllocaInst *>::iterator
+                 it = mSlots.begin();
+             it != mSlots.end(); ++it)
+            mB->CreateStore(
+                mB->CreateLoad(mInt64, it->second),
+                mB->CreateGEP(mInt64, fp, mB->getInt64(it->first)));
+        llvm::Value *ret = &*std::next(mFn->arg_begin());
+        mB->CreateStore(mB->CreateLoad(mInt64, mRetVal), ret);
+        mB->CreateRet(mB->CreateLoad(mB->getInt32Ty(), mCompletion));
+    }
+
+    llvm::BasicBlock *newBlock(const char *name) {
+        return llvm::BasicBlock::Create(*mContext, name, mFn);
+    }
+
+    /// Branch to target unless the current block already ended
+    void branch(llvm::BasicBlock *target) {
+        if (!mB->GetInsertBlock()->getTerminator()) mB->CreateBr(target);
+    }
+
+    /// Branch to target and continue in a fresh block
+    void jump(llvm::BasicBlock *target) {
+        branch(target);
+        mB->SetInsertPoint(newBlock("cont"));
+    }
+
+    /// Continue in block, falling through from the current one
+    void enterBlock(llvm::BasicBlock *block) {
+        branch(block);
+        mB->SetInsertPoint(block);
+    }
+
+    /// The storage of a variable: a constant address for globals, an alloca
+    /// loaded from the incoming arguments or frame for locals
+    llvm::Value *slotAddr(const VarSlot &s) {
+        if (s.global)
+            return constPtr(mEnv.globalSlots() + s.index);
+        llvm::AllocaInst *&addr = mSlots[s.index];
+        if (!addr) {
+            llvm::IRBuilder<> entry(mEntry);
+            addr = entry.CreateAlloca(mInt64);
+            llvm::Value *init = entry.getInt64(0);
+            if (mLoopMode || s.index < mNumParams)
+                init = entry.CreateLoad(
+                    mInt64, entry.CreateGEP(mInt64, mIncoming,
+                                            entry.getInt64(s.index)));
+            entry.CreateStore(init, addr);
+        }
+        return addr;
+    }
+
+    llvm::Value *constPtr(const void *addr) {
+        return llvm::ConstantExpr::getIntToPtr(
+            mB->getInt64((uint64_t)addr), mInt64->getPointerTo());
+    }
+
+    /// Call a runtime callback by its address
+    llvm::Value *runtime(void *fn, llvm::Type *result,
+                         llvm::ArrayRef<llvm::Value *> args) {
+        llvm::SmallVector<llvm::Type *, 3> params;
+        for (unsigned i = 0; i < args.size(); i++)
+            params.push_back(args[i]->getType());
+        llvm::FunctionType *type =
+            llvm::FunctionType::get(result, params, false);
+        llvm::Value *callee = llvm::ConstantExpr::getIntToPtr(
+            mB->getInt64((uint64_t)fn), type->getPointerTo());
+        return mB->CreateCall(type, callee, args);
+    }
+
+    llvm::Value *envPtr() {
+        return llvm::ConstantExpr::getIntToPtr(mB->getInt64((uint64_t)&mEnv),
+                                               mB->getInt8PtrTy());
+    }
+
+    //===------------------------------------------------------------------===//
+    // Statements
+    //===------------------------------------------------------------------===//
+
+    void stmt(Stmt *s) {
+        if (!s || mFailed) return;
+        if (Expr *e = dyn_cast<Expr>(s)) {
+            expr(e);
+        } else if (CompoundStmt *cs = dyn_cast<CompoundStmt>(s)) {
+            for (CompoundStmt::body_iterator i = cs->body_begin(),
+                                             e = cs->body_end();
+                 i != e; ++i)
+                stmt(*i);
+        } else if (DeclStmt *ds = dyn_cast<DeclStmt>(s)) {
+            for (DeclStmt::decl_iterator i = ds->decl_begin(),
+                                         e = ds->decl_end();
+                 i != e; ++i) {
+                if (VarDecl *vdecl = dyn_cast<VarDecl>(*i)) vardecl(vdecl);
+            }
+        } else if (IfStmt *is = dyn_cast<IfStmt>(s)) {
+            Stmt *taken;
+            if (ConstantFolder::prune(is, taken)) return stmt(taken);
+            llvm::Value *cond = truth(is->getCond());
+            llvm::BasicBlock *thenBB = newBlock("then");
+            llvm::BasicBlock *elseBB = is->getElse() ? newBlock("else") : NULL;
+            llvm::BasicBlock *endBB = newBlock("endif");
+            mB->CreateCondBr(cond, thenBB, elseBB ? elseBB : endBB);
+            mB->SetInsertPoint(thenBB);
+            stmt(is->getThen());
+            if (elseBB) {
+                branch(endBB);
+                mB->SetInsertPoint(elseBB);
+                stmt(is->getElse());
+            }
+            enterBlock(endBB);
+        } else if (isa<WhileStmt>(s) || isa<ForStmt>(s)) {
+            lowerLoop(s, true);
+        } else if (ReturnStmt *rs = dyn_cast<ReturnStmt>(s)) {
+            if (CallExpr *call = mEnv.tailCall(rs)) return tailCall(call);
+            Expr *rexpr = rs->getRetValue();
+            mB->CreateStore(rexpr ? expr(rexpr) : mB->getInt64(0), mRetVal);
+            if (mCompletion) mB->CreateStore(mB->getInt32(1), mCompletion);
+            jump(mExit);
+        } else if (isa<BreakStmt>(s) || isa<ContinueStmt>(s)) {
+            if (mLoopTargets.empty()) return unsupported();
+            jump(isa<BreakStmt>(s) ? mLoopTargets.back().first
+                                   : mLoopTargets.back().second);
+        } else if (!isa<NullStmt>(s)) {
+            unsupported();
+        }
+    }
+
+    /// Lower a tail call without growing the native stack, as the walker
+    /// reuses the frame: a call of the function itself runs the body again
+    /// on the new arguments. Functions and loops with any other tail call
+    /// stay in the walker, a native call would nest where it does not.
+    void tailCall(CallExpr *call) {
+        if (mLoopMode ||
+            call->getDirectCallee()->getCanonicalDecl() !=
+                mFunction->getCanonicalDecl() ||
+            call->getNumArgs() != mNumParams)
+            return unsupported();
+        llvm::SmallVector<llvm::Value *, 8> args;
+        for (unsigned i = 0; i < call->getNumArgs(); i++)
+            args.push_back(expr(call->getArg(i)));
+        if (!mRecur) {
+            llvm::IRBuilder<> entry(mEntry);
+            mTailArgs = entry.CreateAlloca(mInt64, entry.getInt64(mNumParams));
+            mRecur = newBlock("recur");
+        }
+        for (unsigned i = 0; i < args.size(); i++)
+            mB->CreateStore(args[i],
+                            mB->CreateGEP(mInt64, mTailArgs, mB->getInt64(i)));
+        jump(mRecur);
+    }
+
+    /// Lower a while or for loop. The init statement of a for loop is left
+    /// out when the walker already ran it.
+    void lowerLoop(Stmt *s, bool withInit) {
+        Expr *cond;
+        Expr *inc = NULL;
+        Stmt *body;
+        if (WhileStmt *ws = dyn_cast<WhileStmt>(s)) {
+            cond = ws->getCond();
+            body = ws->getBody();
+        } else {
+            ForStmt *fs = cast<ForStmt>(s);
+            if (withInit) stmt(fs->getInit());
+            cond = fs->getCond();
+            inc = fs->getInc();
+            body = fs->getBody();
+        }
+        llvm::BasicBlock *condBB = newBlock("cond");
+        llvm::BasicBlock *bodyBB = newBlock("loop");
+        llvm::BasicBlock *incBB = newBlock("inc");
+        llvm::BasicBlock *endBB = newBlock("endloop");
+        enterBlock(condBB);
+        if (cond)
+            mB->CreateCondBr(truth(cond), bodyBB, endBB);
+        else
+            mB->CreateBr(bodyBB);
+        mB->SetInsertPoint(bodyBB);
+        mLoopTargets.push_back(std::make_pair(endBB, incBB));
+        stmt(body);
+        mLoopTargets.pop_back();
+        enterBlock(incBB);
+        if (inc) expr(inc);
+        mB->CreateBr(condBB);
+        mB->SetInsertPoint(endBB);
+    }
+
+    /// Bind a declared variable like Environment::vardecl
+    void vardecl(VarDecl *vdecl) {
+        VarSlot s;
+        if (!mEnv.lookupSlot(vdecl, s)) return unsupported();
+        const Type *type = vdecl->getType().getTypePtr();
+        llvm::Value *val;
+        if (type->isArrayType()) {
+            const ConstantArrayType *atype = dyn_cast<ConstantArrayType>(type);
+            if (!atype) return unsupported();
+            const Type *element = atype->getElementType().getTypePtr();
+            long asize = atype->getSize().getSExtValue();
+            if (asize <= 0) return unsupported();
+            if (!element->isIntegerType() && !element->isPointerType())
+                return;
+            const LocalArray *array = mEnv.lookupLocalArray(vdecl);
+            if (!array) return unsupported();
+            if (mLoopMode) {
+                // the array lives in the frame of the walker
+                llvm::Value *decl = llvm::ConstantExpr::getIntToPtr(
+                    mB->getInt64((uint64_t)vdecl), mB->getInt8PtrTy());
+                val = runtime((void *)&rtLocalArray, mInt64,
+                              {envPtr(), decl});
+            } else {
+                val = mB->CreateAdd(mArrays, mB->getInt64(array->offset));
+                if (array->size >= (long)ZeroPages::kThreshold)
+                    runtime((void *)&rtZero, mB->getVoidTy(),
+                            {val, mB->getInt64(array->size)});
+                else
+                    mB->CreateMemSet(
+                        mB->CreateIntToPtr(val, mB->getInt8PtrTy()),
+                        mB->getInt8(0), array->size, llvm::MaybeAlign(16));
+            }
+        } else if (type->isIntegerType() || type->isPointerType()) {
+            val = vdecl->hasInit() ? expr(vdecl->getInit()) : mB->getInt64(0);
+        } else {
+            val = mB->getInt64(0);
+        }
+        mB->CreateStore(val, slotAddr(s));
+    }
+
+    //===------------------------------------------------------------------===//
+    // Expressions
+    //===------------------------------------------------------------------===//
+
+    llvm::Value *truth(Expr *cond) {
+        return mB->CreateICmpNE(expr(cond), mB->getInt64(0));
+    }
+
+    llvm::Value *expr(Expr *e) {
+        long value;
+        if (mFailed) return mB->getInt64(0);
+        if (ConstantFolder::fold(e, value)) {
+            return mB->getInt64(value);
+        } else if (ParenExpr *pe = dyn_cast<ParenExpr>(e)) {
+            return expr(pe->getSubExpr());
+        } else if (CastExpr *ce = dyn_cast<CastExpr>(e)) {
+            return expr(ce->getSubExpr());
+        } else if (DeclRefExpr *dref = dyn_cast<DeclRefExpr>(e)) {
+            VarSlot s;
+            if (!mEnv.lookupSlot(dref->getFoundDecl(), s)) {
+                unsupported();
+                return mB->getInt64(0);
+            }
+            return mB->CreateLoad(mInt64, slotAddr(s));
+        } else if (BinaryOperator *bop = dyn_cast<BinaryOperator>(e)) {
+            return bop->isAssignmentOp() ? assign(bop) : binop(bop);
+        } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(e)) {
+            llvm::Value *val = expr(uop->getSubExpr());
+            switch (uop->getOpcode()) {
+                case UO_Plus:
+                    return val;
+                case UO_Minus:
+                    return mB->CreateNeg(val);
+                case UO_Deref:
+                    return runtime(
+                        (void *)&rtLoad, mInt64,
+                        {envPtr(), val,
+                         mB->getInt64(TypeLayout::sizeOf(uop->getType()))});
+                default:
+                    unsupported();
+                    return val;
+            }
+        } else if (ArraySubscriptExpr *ae = dyn_cast<ArraySubscriptExpr>(e)) {
+            llvm::Value *base = expr(ae->getBase());
+            llvm::Value *index = expr(ae->getIdx());
+            llvm::Type *type = elementType(ae);
+            return mB->CreateSExt(
+                mB->CreateLoad(type, element(type, base, index)), mInt64);
+        } else if (CallExpr *call = dyn_cast<CallExpr>(e)) {
+            return callexpr(call);
+        }
+        unsupported();
+        return mB->getInt64(0);
+    }
+
+    /// The integer type the elements of ae are stored as
+    llvm::Type *elementType(ArraySubscriptExpr *ae) {
+        return mB->getIntNTy(8 * TypeLayout::sizeOf(ae->getType()));
+    }
+
+    llvm::Value *element(llvm::Type *type, llvm::Value *base,
+                         llvm::Value *index) {
+        llvm::Value *arr = mB->CreateIntToPtr(base, type->getPointerTo());
+        return mB->CreateGEP(type, arr, index);
+    }
+
+    /// Assignments evaluate their value first, like the walker
+    llvm::Value *assign(BinaryOperator *bop) {
+        if (bop->getOpcode() != BO_Assign) {
+            unsupported();
+            return mB->getInt64(0);
+        }
+        llvm::Value *val = expr(bop->getRHS());
+        Expr *left = bop->getLHS();
+        if (DeclRefExpr *dref = dyn_cast<DeclRefExpr>(left)) {
+            VarSlot s;
+            if (mEnv.lookupSlot(dref->getFoundDecl(), s))
+                mB->CreateStore(val, slotAddr(s));
+            else
+                unsupported();
+        } else if (ArraySubscriptExpr *ae =
+                       dyn_cast<ArraySubscriptExpr>(left)) {
+            llvm::Value *index = expr(ae->getIdx());
+            llvm::Value *base = expr(ae->getBase());
+            llvm::Type *type = elementType(ae);
+            mB->CreateStore(mB->CreateTrunc(val, type),
+                            element(type, base, index));
+        } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(left)) {
+            llvm::Value *addr = expr(uop->getSubExpr());
+            runtime((void *)&rtStore, mB->getVoidTy(),
+                    {envPtr(), addr, val,
+                     mB->getInt64(TypeLayout::sizeOf(uop->getType()))});
+        } else {
+            unsupported();
+        }
+        return val;
+    }
+
+    /// Arithmetic and comparisons like Environment::arith
+    llvm::Value *binop(BinaryOperator *bop) {
+        llvm::Value *l = expr(bop->getLHS());
+        llvm::Value *r = expr(bop->getRHS());
+        long stride = TypeLayout::stride(bop->getLHS()->getType());
+        if (stride && bop->isAdditiveOp() &&
+            !bop->getRHS()->getType()->isPointerType())
+            r = mB->CreateMul(r, mB->getInt64(stride));
+        switch (bop->getOpcode()) {
+            case BO_Add:
+                return mB->CreateAdd(l, r);
+            case BO_Sub:
+                return mB->CreateSub(l, r);
+            case BO_Mul:
+                return mB->CreateMul(l, r);
+            case BO_Div:
+                return mB->CreateSDiv(l, r);
+            case BO_Rem:
+                return mB->CreateSRem(l, r);
+            case BO_GT:
+                return mB->CreateZExt(mB->CreateICmpSGT(l, r), mInt64);
+            case BO_LT:
+                return mB->CreateZExt(mB->CreateICmpSLT(l, r), mInt64);
+            case BO_EQ:
+                return mB->CreateZExt(mB->CreateICmpEQ(l, r), mInt64);
+            case BO_GE:
+                return mB->CreateZExt(mB->CreateICmpSGE(l, r), mInt64);
+            case BO_LE:
+                return mB->CreateZExt(mB->CreateICmpSLE(l, r), mInt64);
+            case BO_NE:
+                return mB->CreateZExt(mB->CreateICmpNE(l, r), mInt64);
+            default:
+                unsupported();
+                return l;
+        }
+    }
+
+    llvm::Value *callexpr(CallExpr *call) {
+        QuickInfo *q = mEnv.quicken(call);
+        llvm::SmallVector<llvm::Value *, 8> args;
+        for (unsigned i = 0; i < call->getNumArgs(); i++)
+            args.push_back(expr(call->getArg(i)));
+        if (q->handler == QuickInfo::Builtin) {
+            switch (q->value) {
+                case QuickInfo::BI_Input:
+                    return runtime((void *)&rtInput, mInt64, {envPtr()});
+                case QuickInfo::BI_Output:
+                    runtime((void *)&rtOutput, mB->getVoidTy(),
+                            {envPtr(), args[0]});
+                    return mB->getInt64(0);
+                case QuickInfo::BI_Malloc:
+                    return runtime((void *)&rtMalloc, mInt64,
+                                   {envPtr(), args[0]});
+                case QuickInfo::BI_Free:
+                    runtime((void *)&rtFree, mB->getVoidTy(),
+                            {envPtr(), args[0]});
+                    return mB->getInt64(0);
+            }
+        }
+        if (q->handler != QuickInfo::Call || q->counter->failed) {
+            unsupported();
+            return mB->getInt64(0);
+        }
+        // arguments are passed in a buffer laid out like the parameter slots
+        llvm::Value *buffer =
+            llvm::ConstantPointerNull::get(mInt64->getPointerTo());
+        if (!args.empty()) {
+            llvm::IRBuilder<> entry(mEntry);
+            buffer = entry.CreateAlloca(mInt64, entry.getInt64(args.size()));
+            for (unsigned i = 0; i < args.size(); i++)
+                mB->CreateStore(
+                    args[i], mB->CreateGEP(mInt64, buffer, mB->getInt64(i)));
+        }
+        llvm::Value *callee;
+        if (q->counter->native)
+            callee = llvm::ConstantExpr::getIntToPtr(
+                mB->getInt64((uint64_t)q->counter->native),
+                mFunctionType->getPointerTo());
+        else
+            callee = declare(q->callee);
+        llvm::Value *result = mB->CreateCall(mFunctionType, callee, {buffer});
+        unwindIfOverflowed();
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+//==--- MemoCache.h - Bounded cache of pure function results --------------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_MEMO_CACHE_H
+#define AST_INTERPRETER_MEMO_CACHE_H
+
+#include <stdio.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Maps a call of a pure guest function, identified by the function and its
+/// argument tuple, to the value it returned. The cache holds at most a fixed
+/// number of entries; once full, inserting evicts the least recently used
+/// entry (LRU) or the oldest one (FIFO).
+class MemoCache {
+   public:
+    enum Policy { LRU, FIFO };
+
+   private:
+    /// The function followed by the arguments
+    typedef std::vector<long> Key;
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            size_t h = 14695981039346656037UL;
+            for (unsigned i = 0; i < key.size(); i++)
+                h = (h ^ (size_t)key[i]) * 1099511628211UL;
+            return h;
+        }
+    };
+
+    struct Entry {
+        Key key;
+        long value;
+    };
+
+    struct Stats {
+        std::string name;
+        long hits = 0;
+        long misses = 0;
+    };
+
+    size_t mCapacity;
+    Policy mPolicy;
+    /// Entries, most recently inserted (or used, for LRU) first
+    std::list<Entry> mEntries;
+    typedef std::unordered_map<Key, std::list<Entry>::iterator, KeyHash>
+        Index;
+    Index mIndex;
+    std::unordered_map<const void *, Stats> mStats;
+    std::vector<const void *> mOrder;  /// functions in registration order
+    long mEvictions = 0;
+    /// Scratch key, reused so a lookup does not allocate
+    Key mKey;
+
+   public:
+    MemoCache(size_t capacity, Policy policy)
+        : mCapacity(capacity), mPolicy(policy) {}
+
+    /// Register a memoizable function under the name used in the report
+    void addFunction(const void *fn, const std::string &name) {
+        if (!mStats.count(fn)) mOrder.push_back(fn);
+        mStats[fn].name = name;
+    }
+
+    /// Look up the result of fn(args[0], ..., args[n - 1])
+    bool lookup(const void *fn, const long *args, unsigned n, long &value) {
+        makeKey(fn, args, n);
+        Stats &stats = mStats[fn];
+        Index::iterator it = mIndex.find(mKey);
+        if (it == mIndex.end()) {
+            stats.misses++;
+            return false;
+        }
+        stats.hits++;
+        if (mPolicy == LRU)
+            mEntries.splice(mEntries.begin(), mEntries, it->second);
+        value = it->second->value;
+        return true;
+    }
+
+    /// Record the result of fn(args[0], ..., args[n - 1])
+    void insert(const void *fn, const long *args, unsigned n, long value) {
+        if (mCapacity == 0) return;
+        makeKey(fn, args, n);
+        if (mIndex.count(mKey)) return;
+        if (mEntries.size() >= mCapacity) {
+            mIndex.erase(mEntries.back().key);
+            mEntries.pop_back();
+            mEvictions++;
+        }
+        Entry entry = {mKey, value};
+        mEntries.push_front(entry);
+        mIndex[mKey] = mEntries.begin();
+    }
+
+    /// Print hit and miss counts, per function and in total
+    void report(FILE *out) {
+        long hits = 0, misses = 0;
+        for (unsigned i = 0; i < mOrder.size(); i++) {
+            const Stats &stats = mStats[mOrder[i]];
+            fprintf(out, "Memo: %s: %ld hits, %ld misses\n",
+                    stats.name.c_str(), stats.hits, stats.misses);
+            hits += stats.hits;
+            misses += stats.misses;
+        }
+        fprintf(out,
+                "Memo: %ld hits, %ld misses (%.1f%% hit rate), %zu of %zu "
+                "entries used, %ld evictions (%s)\n",
+                hits, misses,
+                hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+                mEntries.size(), mCapacity, mEvictions,
+                mPolicy == LRU ? "lru" : "fifo");
+    }
+
+   private:
+    void makeKey(const void *fn, const long *args, unsigned n) {
+        mKey.assign(1, (long)fn);
+        mKey.insert(mKey.end(), args, args + n);
+    }
+};
+
+#endif
@@ -0,0 +1,199 @@
+//==--- Profiler.h - Exact guest level profile of the AST walker ----------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_PROFILER_H
+#define AST_INTERPRETER_PROFILER_H
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+
+using namespace clang;
+
+/// Counts every call and statement the walker runs. Calls are timed on a
+/// shadow stack of the guest frames; the time spent in a function itself is
+/// charged both to the function and to the call path leading to it, which
+/// gives the folded stacks flamegraph tools read. Loop iteration counts come
+/// for free: a loop runs its body once per iteration.
+class Profiler {
+    /// A distinct call path, child of the path of its caller
+    struct Node {
+        Node(const FunctionDecl *fn, Node *parent)
+            : fn(fn), parent(parent), children(), selfNs(0) {}
+
+        const FunctionDecl *fn;
+        Node *parent;
+        llvm::DenseMap<const FunctionDecl *, Node *> children;
+        long selfNs;
+    };
+
+    struct FunctionStats {
+        unsigned long calls = 0;
+        long inclusiveNs = 0;  /// outermost activations only under recursion
+        long exclusiveNs = 0;
+        unsigned active = 0;  /// activations on the stack
+    };
+
+    struct Activation {
+        Node *node;
+        long start;
+        long childNs;  /// inclusive time of the callees
+    };
+
+    std::deque<Node> mNodes;
+    std::vector<Activation> mStack;
+    llvm::MapVector<const FunctionDecl *, FunctionStats> mFunctions;
+    llvm::DenseMap<const Stmt *, unsigned long> mStmts;
+
+   public:
+    Profiler() { mNodes.emplace_back((const FunctionDecl *)NULL, NULL); }
+
+    void enter(const FunctionDecl *fn) {
+        fn = fn->getCanonicalDecl();
+        Node *parent = mStack.empty() ? &mNodes.front() : mStack.back().node;
+        Node *&node = parent->children[fn];
+        if (!node) {
+            mNodes.emplace_back(fn, parent);
+            node = &mNodes.back();
+        }
+        FunctionStats &stats = mFunctions[fn];
+        stats.calls++;
+        stats.active++;
+        Activation a = {node, now(), 0};
+        mStack.push_back(a);
+    }
+
+    void exit() {
+        Activation a = mStack.back();
+        mStack.pop_back();
+        long elapsed = now() - a.start;
+        long self = elapsed - a.childNs;
+        a.node->selfNs += self;
+        FunctionStats &stats = mFunctions[a.node->fn];
+        stats.exclusiveNs += self;
+        if (--stats.active == 0) stats.inclusiveNs += elapsed;
+        if (!mStack.empty()) mStack.back().childNs += elapsed;
+    }
+
+    /// A tail call replaces the frame of the caller
+    void tailCall(const FunctionDecl *callee) {
+        exit();
+        enter(callee);
+    }
+
+    void statement(const Stmt *stmt) { ++mStmts[stmt]; }
+
+    /// Write <prefix>.folded and <prefix>.json. Returns false if a file
+    /// cannot be written.
+    bool write(const SourceManager &sm, const std::string &prefix) {
+        while (!mStack.empty()) exit();
+        FILE *folded = fopen((prefix + ".folded").c_str(), "w");
+        if (!folded) return false;
+        for (unsigned i = 1; i < mNodes.size(); i++)
+            if (mNodes[i].selfNs > 0)
+                fprintf(folded, "%s %ld\n", path(&mNodes[i]).c_str(),
+                        mNodes[i].selfNs);
+        bool ok = fclose(folded) == 0;
+        FILE *json = fopen((prefix + ".json").c_str(), "w");
+        if (!json) return false;
+        writeJSON(sm, json);
+        return fclose(json) == 0 && ok;
+    }
+
+   private:
+    static long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /// Frames from the outermost, separated by semicolons
+    static std::string path(const Node *node) {
+        std::string s = node->fn->getNameAsString();
+        for (node = node->parent; node->fn; node = node->parent)
+            s = node->fn->getNameAsString() + ";" + s;
+        return s;
+    }
+
+    static void location(const SourceManager &sm, SourceLocation loc,
+                         FILE *out) {
+        fprintf(out, "\"line\": %u, \"column\": %u",
+                sm.getSpellingLineNumber(loc), sm.getSpellingColumnNumber(loc));
+    }
+
+    void writeJSON(const SourceManager &sm, FILE *out) {
+        std::vector<std::pair<const FunctionDecl *, FunctionStats> > fns(
+            mFunctions.begin(), mFunctions.end());
+        std::stable_sort(fns.begin(), fns.end(),
+                         [](const std::pair<const FunctionDecl *,
+                                            FunctionStats> &a,
+                            const std::pair<const FunctionDecl *,
+                                            FunctionStats> &b) {
+                             return a.second.exclusiveNs >
+                                    b.second.exclusiveNs;
+                         });
+        fprintf(out, "{\n  \"functions\": [");
+        for (unsigned i = 0; i < fns.size(); i++) {
+            fprintf(out, "%s\n    {\"name\": \"%s\", ", i ? "," : "",
+                    fns[i].first->getNameAsString().c_str());
+            location(sm, fns[i].first->getLocation(), out);
+            fprintf(out,
+                    ", \"calls\": %lu, \"inclusive_ns\": %ld, "
+                    "\"exclusive_ns\": %ld}",
+                    fns[i].second.calls, fns[i].second.inclusiveNs,
+                    fns[i].second.exclusiveNs);
+        }
+
+        // statements and loops in source order
+        std::vector<std::pair<SourceLocation, const Stmt *> > stmts;
+        for (llvm::DenseMap<const Stmt *, unsigned long>::iterator
+                 it = mStmts.begin();
+             it != mStmts.end(); ++it)
+            stmts.push_back(std::make_pair(it->first->getBeginLoc(),
+                                           it->first));
+        std::sort(stmts.begin(), stmts.end(),
+                  [&sm](const std::pair<SourceLocation, const Stmt *> &a,
+                        const std::pair<SourceLocation, const Stmt *> &b) {
+                      if (a.first != b.first)
+                          return sm.isBeforeInTranslationUnit(a.first,
+                                                              b.first);
+                      return a.second < b.second;
+                  });
+        fprintf(out, "\n  ],\n  \"statements\": [");
+        for (unsigned i = 0; i < stmts.size(); i++) {
+            fprintf(out, "%s\n    {\"kind\": \"%s\", ", i ? "," : "",
+                    stmts[i].second->getStmtClassName());
+            location(sm, stmts[i].first, out);
+            fprintf(out, ", \"count\": %lu}", mStmts.lookup(stmts[i].second));
+        }
+        fprintf(out, "\n  ],\n  \"loops\": [");
+        bool first = true;
+        for (unsigned i = 0; i < stmts.size(); i++) {
+            const Stmt *body = NULL;
+            if (const WhileStmt *w = dyn_cast<WhileStmt>(stmts[i].second))
+                body = w->getBody();
+            else if (const ForStmt *f = dyn_cast<ForStmt>(stmts[i].second))
+                body = f->getBody();
+            else
+                continue;
+            fprintf(out, "%s\n    {\"kind\": \"%s\", ", first ? "" : ",",
+                    stmts[i].second->getStmtClassName());
+            location(sm, stmts[i].first, out);
+            fprintf(out, ", \"entries\": %lu, \"iterations\": %lu}",
+                    mStmts.lookup(stmts[i].second), mStmts.lookup(body));
+            first = false;
+        }
+        fprintf(out, "\n  ]\n}\n");
+    }
+};
+
+#endif
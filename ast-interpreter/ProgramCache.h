@@ -0,0 +1,289 @@
+//==--- ProgramCache.h - Lowered programs cached on disk by source hash ---===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_PROGRAM_CACHE_H
+#define AST_INTERPRETER_PROGRAM_CACHE_H
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "Bytecode.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+
+/// A directory of lowered programs, one file per distinct source text named
+/// after the MD5 of the source. A hit gives back the Program the
+/// BytecodeCompiler produced, so a repeated run needs neither Clang nor the
+/// compiler. Files are written to a temporary name and renamed into place,
+/// so concurrent runs never see a partial entry, and anything that does not
+/// validate is treated as a miss.
+class ProgramCache {
+    /// Bump whenever the bytecode or this format changes
+    static const unsigned kVersion = 3;
+    /// Bytes all global arrays of a valid entry take at most, the address
+    /// space GuestMemory reserves by default
+    static const long kMaxArrayBytes = 1L << 36;
+
+    std::string mDir;
+
+   public:
+    explicit ProgramCache(const std::string &dir) : mDir(dir) {}
+
+    bool load(llvm::StringRef source, Program &program) {
+        FILE *in = fopen(path(source).c_str(), "rb");
+        if (!in) return false;
+        long size = -1;
+        if (fseek(in, 0, SEEK_END) == 0) size = ftell(in);
+        bool ok = size >= 0 && fseek(in, 0, SEEK_SET) == 0 &&
+                  read(in, size, program) && validate(program);
+        fclose(in);
+        if (!ok) program = Program();
+        return ok;
+    }
+
+    void store(llvm::StringRef source, const Program &program) {
+        if (llvm::sys::fs::create_directories(mDir)) return;
+        std::string final = path(source);
+        std::string temp = final + "." + std::to_string(getpid()) + ".tmp";
+        FILE *out = fopen(temp.c_str(), "wb");
+        if (!out) return;
+        bool ok = write(out, program);
+        ok = fclose(out) == 0 && ok;
+        if (!ok || rename(temp.c_str(), final.c_str()) != 0)
+            remove(temp.c_str());
+    }
+
+   private:
+    std::string path(llvm::StringRef source) {
+        llvm::MD5 hash;
+        hash.update(source);
+        llvm::MD5::MD5Result result;
+        hash.final(result);
+        llvm::SmallString<32> hex;
+        llvm::MD5::stringifyResult(result, hex);
+        return mDir + "/" + hex.str().str() + ".bc";
+    }
+
+    //===------------------------------------------------------------------===//
+    // Serialization. Integers are stored in host byte order, the cache is
+    // not meant to be shared between machines.
+    //===------------------------------------------------------------------===//
+
+    static bool put(FILE *out, long value) {
+        return fwrite(&value, sizeof(value), 1, out) == 1;
+    }
+
+    static bool get(FILE *in, long &value) {
+        return fread(&value, sizeof(value), 1, in) == 1;
+    }
+
+    static bool write(FILE *out, const Program &program) {
+        bool ok = fwrite("ASTIBC", 6, 1, out) == 1 && put(out, kVersion) &&
+                  put(out, program.numGlobals) && put(out, program.init) &&
+                  put(out, program.entry) &&
+                  put(out, program.constants.size());
+        for (unsigned i = 0; ok && i < program.constants.size(); i++)
+            ok = put(out, program.constants[i]);
+        ok = ok && put(out, program.functions.size());
+        for (unsigned i = 0; ok && i < program.functions.size(); i++) {
+            const Function &fn = program.functions[i];
+            ok = put(out, fn.name.size()) &&
+                 fwrite(fn.name.data(), 1, fn.name.size(), out) ==
+                     fn.name.size() &&
+                 put(out, fn.numParams) && put(out, fn.numRegs) &&
+                 put(out, fn.arrayBytes) && put(out, fn.pure) &&
+                 put(out, fn.code.size());
+            for (unsigned pc = 0; ok && pc < fn.code.size(); pc++) {
+                const Instr &ins = fn.code[pc];
+                ok = put(out, ins.op) && put(out, ins.a) && put(out, ins.b) &&
+                     put(out, ins.c);
+            }
+        }
+        return ok;
+    }
+
+    /// Read a program from in, fileSize bytes long. Counts are checked
+    /// against what the file could hold before anything is sized by them.
+    static bool read(FILE *in, long fileSize, Program &program) {
+        const long maxLongs = fileSize / (long)sizeof(long);
+        char magic[6];
+        long version, numGlobals, init, entry, count;
+        if (fread(magic, 6, 1, in) != 1 || memcmp(magic, "ASTIBC", 6) != 0 ||
+            !get(in, version) || version != kVersion ||
+            !get(in, numGlobals) || numGlobals < 0 ||
+            numGlobals > maxLongs || !get(in, init) || !get(in, entry) ||
+            !get(in, count) || count < 0 || count > maxLongs)
+            return false;
+        program.numGlobals = numGlobals;
+        program.init = init;
+        program.entry = entry;
+        for (long i = 0; i < count; i++) {
+            long value;
+            if (!get(in, value)) return false;
+            program.constants.push_back(value);
+        }
+        // a function takes at least seven longs and an instruction four
+        if (!get(in, count) || count < 0 || count > maxLongs / 7) return false;
+        program.functions.resize(count);
+        for (long i = 0; i < count; i++) {
+            Function &fn = program.functions[i];
+            long length, numParams, numRegs, arrayBytes, pure, size;
+            if (!get(in, length) || length < 0 || length > 4096) return false;
+            fn.name.resize(length);
+            if (fread(&fn.name[0], 1, length, in) != (size_t)length ||
+                !get(in, numParams) || numParams < 0 || !get(in, numRegs) ||
+                numRegs < 0 || numRegs > UINT_MAX || !get(in, arrayBytes) ||
+                arrayBytes < 0 || arrayBytes > UINT_MAX || !get(in, pure) ||
+                !get(in, size) || size < 0 || size > maxLongs / 4)
+                return false;
+            fn.numParams = numParams;
+            fn.numRegs = numRegs;
+            fn.arrayBytes = arrayBytes;
+            fn.pure = pure;
+            fn.code.resize(size);
+            for (long pc = 0; pc < size; pc++) {
+                long op, a, b, c;
+                if (!get(in, op) || !get(in, a) || !get(in, b) || !get(in, c))
+                    return false;
+                Instr ins = {(Opcode)op, (int)a, (int)b, (int)c};
+                fn.code[pc] = ins;
+            }
+        }
+        return true;
+    }
+
+    enum { kRegA = 1, kRegB = 2, kRegC = 4 };
+
+    /// Which of a, b and c name registers of the frame, after Bytecode.h
+    static int registerOperands(Opcode op) {
+        switch (op) {
+            case OP_LoadImm:
+            case OP_LoadConst:
+            case OP_LoadGlobal:
+            case OP_StoreGlobal:
+            case OP_JmpZ:
+            case OP_JmpNZ:
+            case OP_NewArray:
+            case OP_FrameArray:
+            case OP_Call:
+            case OP_Ret:
+            case OP_Get:
+            case OP_Print:
+            case OP_Free:
+                return kRegA;
+            case OP_Mov:
+            case OP_AddImm:
+            case OP_MulImm:
+            case OP_Neg:
+            case OP_JLt:
+            case OP_JLe:
+            case OP_JGt:
+            case OP_JGe:
+            case OP_JEq:
+            case OP_JNe:
+            case OP_Load:
+            case OP_Store:
+            case OP_Malloc:
+                return kRegA | kRegB;
+            case OP_Add:
+            case OP_Sub:
+            case OP_Mul:
+            case OP_Div:
+            case OP_Rem:
+            case OP_Lt:
+            case OP_Le:
+            case OP_Gt:
+            case OP_Ge:
+            case OP_Eq:
+            case OP_Ne:
+            case OP_LoadElem:
+            case OP_StoreElem:
+            case OP_LoadElemInt:
+            case OP_StoreElemInt:
+            case OP_LoadElemChar:
+            case OP_StoreElemChar:
+                return kRegA | kRegB | kRegC;
+            default:
+                return 0;
+        }
+    }
+
+    /// Check the references a damaged file could get wrong
+    static bool validate(const Program &program) {
+        long numFunctions = program.functions.size();
+        long arrayBytes = 0;
+        if (program.init < 0 || program.init >= numFunctions ||
+            program.entry < 0 || program.entry >= numFunctions)
+            return false;
+        for (long i = 0; i < numFunctions; i++) {
+            const Function &fn = program.functions[i];
+            if (fn.code.empty() || fn.numParams > fn.numRegs) return false;
+            for (unsigned pc = 0; pc < fn.code.size(); pc++) {
+                const Instr &ins = fn.code[pc];
+                if (ins.op >= OP_COUNT) return false;
+                int regs = registerOperands(ins.op);
+                if (((regs & kRegA) && !isRegister(fn, ins.a)) ||
+                    ((regs & kRegB) && !isRegister(fn, ins.b)) ||
+                    ((regs & kRegC) && !isRegister(fn, ins.c)))
+                    return false;
+                switch (ins.op) {
+                    case OP_Call:
+                    case OP_TailCall:
+                        // the arguments are passed in r[c] onwards
+                        if (ins.b < 0 || ins.b >= numFunctions || ins.c < 0 ||
+                            (long)ins.c + program.functions[ins.b].numParams >
+                                (long)fn.numRegs)
+                            return false;
+                        break;
+                    case OP_Jmp:
+                    case OP_JmpZ:
+                    case OP_JmpNZ:
+                    case OP_JLt:
+                    case OP_JLe:
+                    case OP_JGt:
+                    case OP_JGe:
+                    case OP_JEq:
+                    case OP_JNe:
+                        if (ins.c < 0 || ins.c >= (int)fn.code.size())
+                            return false;
+                        break;
+                    case OP_LoadConst:
+                        if (ins.c < 0 ||
+                            ins.c >= (int)program.constants.size())
+                            return false;
+                        break;
+                    case OP_NewArray:
+                        // one per global array, of at least one element
+                        arrayBytes += ins.c;
+                        if (ins.c <= 0 || arrayBytes > kMaxArrayBytes)
+                            return false;
+                        break;
+                    case OP_FrameArray:
+                        if (ins.b < 0 || ins.c < 0 ||
+                            (long)ins.b + ins.c > (long)fn.arrayBytes)
+                            return false;
+                        break;
+                    case OP_LoadGlobal:
+                    case OP_StoreGlobal:
+                        if (ins.c < 0 || ins.c >= (int)program.numGlobals)
+                            return false;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool isRegister(const Function &fn, int reg) {
+        return reg >= 0 && (unsigned)reg < fn.numRegs;
+    }
+};
+
+#endif
@@ -0,0 +1,221 @@
+//==--- Sampler.h - SIGPROF sampling profiler of the AST walker -----------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_SAMPLER_H
+#define AST_INTERPRETER_SAMPLER_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Environment.h"
+#include "clang/AST/ASTContext.h"
+#include "llvm/ADT/DenseMap.h"
+
+/// Samples the guest call stack on every SIGPROF, raised by a CPU time timer
+/// while the walker runs. The handler only copies the statement each frame
+/// is running into a fixed ring buffer; a background thread drains the ring
+/// and counts identical stacks, and the statements are turned into functions
+/// and source lines once the program has ended.
+class Sampler {
+    static const unsigned kMaxDepth = 64;  /// innermost frames kept
+    static const unsigned kCapacity = 4096;
+
+    struct Sample {
+        unsigned depth;
+        const Stmt *pcs[kMaxDepth];  /// innermost first
+    };
+
+    Environment &mEnv;
+    unsigned mRate;
+    pthread_t mThread;  /// the walker, the only thread taking samples
+
+    /// Single producer (the handler) single consumer (the drain thread) ring
+    Sample mRing[kCapacity];
+    std::atomic<unsigned long> mHead;
+    std::atomic<unsigned long> mTail;
+    std::atomic<unsigned long> mDropped;
+
+    std::atomic<bool> mStopping;
+    std::thread mDrain;
+    std::map<std::vector<const Stmt *>, unsigned long> mStacks;
+    unsigned long mSamples;
+    struct sigaction mOldAction;
+
+    static std::atomic<Sampler *> &active() {
+        static std::atomic<Sampler *> sampler(NULL);
+        return sampler;
+    }
+
+   public:
+    /// Sample env rate times per second of CPU time
+    Sampler(Environment &env, unsigned rate)
+        : mEnv(env),
+          mRate(std::max(1u, rate)),
+          mThread(pthread_self()),
+          mHead(0),
+          mTail(0),
+          mDropped(0),
+          mStopping(false),
+          mSamples(0) {}
+
+    ~Sampler() { stop(); }
+
+    void start() {
+        active() = this;
+        // the drain thread starts with SIGPROF blocked so the walker gets
+        // every signal
+        sigset_t prof, old;
+        sigemptyset(&prof);
+        sigaddset(&prof, SIGPROF);
+        pthread_sigmask(SIG_BLOCK, &prof, &old);
+        mDrain = std::thread([this] {
+            while (!mStopping) {
+                drain();
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, &mOldAction);
+        arm(1000000 / mRate);
+    }
+
+    void stop() {
+        if (!mDrain.joinable()) return;
+        arm(0);
+        sigaction(SIGPROF, &mOldAction, NULL);
+        active() = NULL;
+        mStopping = true;
+        mDrain.join();
+        drain();
+    }
+
+    /// Write the sampled stacks, outermost frame first and each frame named
+    /// function:line, to <prefix>.folded, and the statements most often
+    /// sampled to report. Returns false if the file cannot be written.
+    bool write(ASTContext &context, const std::string &prefix,
+               FILE *report) {
+        llvm::DenseMap<const Stmt *, const FunctionDecl *> owners;
+        TranslationUnitDecl *unit = context.getTranslationUnitDecl();
+        for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                                e = unit->decls_end();
+             i != e; ++i)
+            if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i))
+                if (fdecl->doesThisDeclarationHaveABody())
+                    own(fdecl->getBody(), fdecl, owners);
+        const SourceManager &sm = context.getSourceManager();
+
+        FILE *folded = fopen((prefix + ".folded").c_str(), "w");
+        if (!folded) return false;
+        std::map<const Stmt *, unsigned long> self;
+        for (std::map<std::vector<const Stmt *>, unsigned long>::iterator
+                 it = mStacks.begin();
+             it != mStacks.end(); ++it) {
+            const std::vector<const Stmt *> &pcs = it->first;
+            std::string line;
+            for (unsigned i = pcs.size(); i-- > 0;) {
+                line += frame(pcs[i], owners, sm);
+                if (i) line += ";";
+            }
+            fprintf(folded, "%s %lu\n", line.c_str(), it->second);
+            if (!pcs.empty()) self[pcs[0]] += it->second;
+        }
+        bool ok = fclose(folded) == 0;
+
+        std::vector<std::pair<unsigned long, const Stmt *> > hot;
+        for (std::map<const Stmt *, unsigned long>::iterator it = self.begin();
+             it != self.end(); ++it)
+            hot.push_back(std::make_pair(it->second, it->first));
+        std::sort(hot.rbegin(), hot.rend());
+        fprintf(report, "Sampler: %lu samples at %u Hz, %lu dropped\n",
+                mSamples, mRate, mDropped.load());
+        for (unsigned i = 0; i < hot.size() && i < 20; i++)
+            fprintf(report, "Sampler: %5.1f%% %8lu  %s\n",
+                    100.0 * hot[i].first / std::max(1ul, mSamples),
+                    hot[i].first, frame(hot[i].second, owners, sm).c_str());
+        return ok;
+    }
+
+   private:
+    static void arm(long usec) {
+        struct itimerval timer;
+        timer.it_interval.tv_sec = usec / 1000000;
+        timer.it_interval.tv_usec = usec % 1000000;
+        timer.it_value = timer.it_interval;
+        setitimer(ITIMER_PROF, &timer, NULL);
+    }
+
+    /// Async signal safe: atomics and plain loads and stores only
+    static void handler(int) {
+        Sampler *sampler = active().load();
+        if (!sampler || !pthread_equal(pthread_self(), sampler->mThread))
+            return;
+        int saved = errno;
+        sampler->take();
+        errno = saved;
+    }
+
+    void take() {
+        unsigned long head = mHead.load(std::memory_order_relaxed);
+        if (head - mTail.load(std::memory_order_acquire) == kCapacity) {
+            mDropped++;
+            return;
+        }
+        Sample &sample = mRing[head % kCapacity];
+        sample.depth = mEnv.backtrace(sample.pcs, kMaxDepth);
+        if (!sample.depth) {
+            mDropped++;
+            return;
+        }
+        mHead.store(head + 1, std::memory_order_release);
+    }
+
+    void drain() {
+        unsigned long tail = mTail.load(std::memory_order_relaxed);
+        unsigned long head = mHead.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            const Sample &sample = mRing[tail % kCapacity];
+            mStacks[std::vector<const Stmt *>(sample.pcs,
+                                              sample.pcs + sample.depth)]++;
+            mSamples++;
+            mTail.store(tail + 1, std::memory_order_release);
+        }
+    }
+
+    /// Map every statement of body to fdecl
+    static void own(
+        const Stmt *s, const FunctionDecl *fdecl,
+        llvm::DenseMap<const Stmt *, const FunctionDecl *> &owners) {
+        if (!s) return;
+        owners[s] = fdecl;
+        for (const Stmt *child : s->children()) own(child, fdecl, owners);
+    }
+
+    static std::string frame(
+        const Stmt *pc,
+        const llvm::DenseMap<const Stmt *, const FunctionDecl *> &owners,
+        const SourceManager &sm) {
+        if (!pc) return "?";  // frame entered, no statement run yet
+        const FunctionDecl *fdecl = owners.lookup(pc);
+        return (fdecl ? fdecl->getNameAsString() : std::string("?")) + ":" +
+               std::to_string(sm.getSpellingLineNumber(pc->getBeginLoc()));
+    }
+};
+
+#endif
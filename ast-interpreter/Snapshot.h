@@ -0,0 +1,216 @@
+//==--- Snapshot.h - Saved state of a program between calls ---------------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_SNAPSHOT_H
+#define AST_INTERPRETER_SNAPSHOT_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// The state a snapshot saves besides the image of guest memory: the value
+/// stack, frames and globals of the Environment and the metadata of the
+/// allocators, as a flat sequence of integers and byte strings. Integers
+/// are stored in host byte order, like the program cache.
+class SnapshotWriter {
+    std::vector<char> mData;
+
+   public:
+    SnapshotWriter() : mData() {}
+
+    void put(long value) { putBytes(&value, sizeof(value)); }
+
+    void putBytes(const void *data, size_t size) {
+        mData.insert(mData.end(), (const char *)data,
+                     (const char *)data + size);
+    }
+
+    const std::vector<char> &data() const { return mData; }
+};
+
+/// Reads what a SnapshotWriter wrote; every read fails past the end
+class SnapshotReader {
+    const char *mPos;
+    const char *mEnd;
+
+   public:
+    SnapshotReader(const char *data, size_t size)
+        : mPos(data), mEnd(data + size) {}
+
+    bool get(long &value) { return getBytes(&value, sizeof(value)); }
+
+    /// Bytes not read yet, which bound any count read from the state
+    size_t remaining() const { return mEnd - mPos; }
+
+    bool getBytes(void *data, size_t size) {
+        if ((size_t)(mEnd - mPos) < size) return false;
+        memcpy(data, mPos, size);
+        mPos += size;
+        return true;
+    }
+};
+
+/// The state of a program saved at a point where none of its functions is
+/// running. A snapshot lives in a file, or in an anonymous memfd if it is
+/// only kept in memory: a header with the key of the program and the
+/// state, then the image of guest memory, page aligned so it can be mapped
+/// straight back (GuestMemory::mapImage). Pages that are all zero are left
+/// as holes. A snapshot never changes once written, so any number of
+/// restores can map the same image.
+class Snapshot {
+    /// Bump whenever the state or this format changes
+    static const long kVersion = 1;
+
+    int mFd;
+    std::string mKey;
+    std::vector<char> mState;
+    long mImageOffset;
+    long mImageBytes;
+
+    Snapshot()
+        : mFd(-1), mKey(), mState(), mImageOffset(0), mImageBytes(0) {}
+
+   public:
+    /// Writes imageBytes of guest memory to a file descriptor at an offset
+    typedef std::function<bool(int fd, off_t offset)> ImageWriter;
+
+    ~Snapshot() {
+        if (mFd >= 0) close(mFd);
+    }
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+    /// Write a snapshot of the program identified by key to path, or to
+    /// memory if path is empty. The file is written to a temporary name and
+    /// renamed into place. NULL if it cannot be written.
+    static std::unique_ptr<Snapshot> create(const std::string &path,
+                                            const std::string &key,
+                                            const SnapshotWriter &state,
+                                            long imageBytes,
+                                            const ImageWriter &writeImage) {
+        std::unique_ptr<Snapshot> snapshot(new Snapshot());
+        snapshot->mKey = key;
+        snapshot->mState = state.data();
+        snapshot->mImageBytes = imageBytes;
+        SnapshotWriter header;
+        header.putBytes("ASTISNAP", 8);
+        header.put(kVersion);
+        header.put(0);  // image offset, patched below
+        header.put(imageBytes);
+        header.put(key.size());
+        header.putBytes(key.data(), key.size());
+        header.put(state.data().size());
+        header.putBytes(state.data().data(), state.data().size());
+        std::vector<char> head = header.data();
+        long page = sysconf(_SC_PAGESIZE);
+        snapshot->mImageOffset = (head.size() + page - 1) & ~(page - 1);
+        memcpy(&head[8 + sizeof(long)], &snapshot->mImageOffset,
+               sizeof(long));
+
+        std::string temp;
+        if (path.empty()) {
+            snapshot->mFd = memfd_create("guest-snapshot", MFD_CLOEXEC);
+        } else {
+            temp = path + "." + std::to_string(getpid()) + ".tmp";
+            snapshot->mFd =
+                ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0644);
+        }
+        if (snapshot->mFd < 0) return std::unique_ptr<Snapshot>();
+        bool ok = writeAll(snapshot->mFd, head.data(), head.size(), 0) &&
+                  writeImage(snapshot->mFd, snapshot->mImageOffset);
+        if (!temp.empty() &&
+            (!ok || rename(temp.c_str(), path.c_str()) != 0)) {
+            remove(temp.c_str());
+            ok = false;
+        }
+        if (!ok) return std::unique_ptr<Snapshot>();
+        return snapshot;
+    }
+
+    /// Read a snapshot create wrote to path, NULL if there is none or it
+    /// does not validate
+    static std::unique_ptr<Snapshot> open(const std::string &path) {
+        std::unique_ptr<Snapshot> snapshot(new Snapshot());
+        snapshot->mFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (snapshot->mFd < 0 || !snapshot->read())
+            return std::unique_ptr<Snapshot>();
+        return snapshot;
+    }
+
+    /// The program the snapshot was taken of
+    const std::string &key() const { return mKey; }
+
+    SnapshotReader state() const {
+        return SnapshotReader(mState.data(), mState.size());
+    }
+
+    /// Where the image of guest memory starts in fd and its size
+    int fd() const { return mFd; }
+    long imageOffset() const { return mImageOffset; }
+    long imageBytes() const { return mImageBytes; }
+
+    static bool writeAll(int fd, const char *data, size_t size,
+                         off_t offset) {
+        while (size) {
+            ssize_t n = pwrite(fd, data, size, offset);
+            if (n <= 0) return false;
+            data += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+   private:
+    bool readAll(void *data, size_t size, off_t &offset) {
+        char *p = (char *)data;
+        while (size) {
+            ssize_t n = pread(mFd, p, size, offset);
+            if (n <= 0) return false;
+            p += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    /// Every size in the header comes from the file, so each is bounded by
+    /// its length before anything is allocated. An image running past the
+    /// end of the file would fault when the guest touches it.
+    bool read() {
+        struct stat st;
+        char magic[8];
+        long version, keySize, stateSize;
+        off_t offset = 0;
+        long page = sysconf(_SC_PAGESIZE);
+        if (fstat(mFd, &st) != 0 || !readAll(magic, 8, offset) ||
+            memcmp(magic, "ASTISNAP", 8) != 0 ||
+            !readAll(&version, sizeof(long), offset) || version != kVersion ||
+            !readAll(&mImageOffset, sizeof(long), offset) ||
+            mImageOffset < 0 || mImageOffset % page != 0 ||
+            mImageOffset > st.st_size ||
+            !readAll(&mImageBytes, sizeof(long), offset) || mImageBytes < 0 ||
+            mImageBytes % page != 0 ||
+            mImageBytes > st.st_size - mImageOffset ||
+            !readAll(&keySize, sizeof(long), offset) || keySize < 0 ||
+            keySize > 4096)
+            return false;
+        mKey.resize(keySize);
+        if (!readAll(&mKey[0], keySize, offset) ||
+            !readAll(&stateSize, sizeof(long), offset) || stateSize < 0 ||
+            stateSize > mImageOffset - offset)
+            return false;
+        mState.resize(stateSize);
+        return readAll(mState.data(), stateSize, offset);
+    }
+};
+
+#endif
@@ -0,0 +1,68 @@
+//==--- StackBudget.h - Bounded host stack for the recursive AST walker ---===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_STACK_BUDGET_H
+#define AST_INTERPRETER_STACK_BUDGET_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <functional>
+
+/// The walker follows guest calls by recursing on the host stack, so the
+/// main thread's stack (usually 8 MiB) caps the guest call depth. It runs
+/// instead on a thread whose stack is the configured budget, reserved up
+/// front and committed by the kernel only as deep as the program goes. Guest
+/// calls compare the stack pointer with the limit passed to the walker and
+/// stop the program before the stack runs out. This raises and checks the
+/// host stack limit; the walker keeps no explicit stack of its own.
+class StackBudget {
+    /// Bytes kept below the limit for the statements and expressions that
+    /// run between two calls and for reporting the overflow
+    static const size_t kReserve = 256 << 10;
+
+   public:
+    typedef std::function<void(const char *limit)> Body;
+
+    /// Run fn on a thread with a stack of bytes and wait for it, passing the
+    /// lowest stack address guest calls may reach. Runs fn on the calling
+    /// thread without a limit if no such thread can be created.
+    static void run(size_t bytes, const Body &fn) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_t thread;
+        size_t size = std::max<size_t>(bytes, PTHREAD_STACK_MIN + 2 * kReserve);
+        if (pthread_attr_setstacksize(&attr, size) != 0 ||
+            pthread_create(&thread, &attr, start, (void *)&fn) != 0) {
+            fprintf(stderr, "Cannot reserve a stack of %zu bytes.\n", bytes);
+            fn(NULL);
+        } else {
+            pthread_join(thread, NULL);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    /// True once the stack of the current thread has grown past limit
+    static bool exceeded(const char *limit) {
+        return limit && (const char *)__builtin_frame_address(0) < limit;
+    }
+
+   private:
+    static void *start(void *arg) {
+        const Body *fn = (const Body *)arg;
+        const char *limit = NULL;
+        pthread_attr_t attr;
+        void *low;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &low, &size) == 0)
+                limit = (const char *)low + kReserve;
+            pthread_attr_destroy(&attr);
+        }
+        (*fn)(limit);
+        return NULL;
+    }
+};
+
+#endif
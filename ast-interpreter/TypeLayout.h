@@ -0,0 +1,86 @@
+//==--- TypeLayout.h - Sizes and accesses of guest values in memory -------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_TYPE_LAYOUT_H
+#define AST_INTERPRETER_TYPE_LAYOUT_H
+
+#include "clang/AST/Type.h"
+
+using namespace clang;
+
+/// How guest values are laid out in memory. A char takes 1 byte, a short 2,
+/// an int 4, and a long or a pointer 8; arrays hold their elements back to
+/// back. Values in frame slots, registers and the global segment stay
+/// longs: a value is narrowed when it is stored to memory and sign extended
+/// when it is loaded back, and pointer arithmetic steps by the size of the
+/// pointee.
+class TypeLayout {
+   public:
+    /// Bytes of a value of type in memory, what sizeof gives
+    static long sizeOf(QualType type) {
+        const Type *t = type.getCanonicalType().getTypePtr();
+        if (const ConstantArrayType *atype = dyn_cast<ConstantArrayType>(t))
+            return atype->getSize().getSExtValue() *
+                   sizeOf(atype->getElementType());
+        if (const BuiltinType *bt = dyn_cast<BuiltinType>(t)) {
+            switch (bt->getKind()) {
+                case BuiltinType::Void:  // GNU arithmetic on void *
+                case BuiltinType::Bool:
+                case BuiltinType::Char_S:
+                case BuiltinType::Char_U:
+                case BuiltinType::SChar:
+                case BuiltinType::UChar:
+                    return 1;
+                case BuiltinType::Short:
+                case BuiltinType::UShort:
+                    return 2;
+                case BuiltinType::Int:
+                case BuiltinType::UInt:
+                    return 4;
+                default:
+                    break;
+            }
+        }
+        return sizeof(long);
+    }
+
+    /// Bytes one step of pointer arithmetic on a value of type moves, 0 if
+    /// type is not a pointer
+    static long stride(QualType type) {
+        const PointerType *ptype = type->getAs<PointerType>();
+        return ptype ? sizeOf(ptype->getPointeeType()) : 0;
+    }
+
+    /// The value of size bytes at addr, sign extended
+    static long load(const void *addr, long size) {
+        switch (size) {
+            case 1:
+                return *(const signed char *)addr;
+            case 2:
+                return *(const short *)addr;
+            case 4:
+                return *(const int *)addr;
+            default:
+                return *(const long *)addr;
+        }
+    }
+
+    /// Store the low size bytes of val at addr
+    static void store(void *addr, long size, long val) {
+        switch (size) {
+            case 1:
+                *(signed char *)addr = (signed char)val;
+                break;
+            case 2:
+                *(short *)addr = (short)val;
+                break;
+            case 4:
+                *(int *)addr = (int)val;
+                break;
+            default:
+                *(long *)addr = val;
+                break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,383 @@
+//==--- VM.h - Register virtual machine running lowered bytecode ----------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_VM_H
+#define AST_INTERPRETER_VM_H
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Bytecode.h"
+#include "FrameArena.h"
+#include "GuestIO.h"
+#include "Heap.h"
+#include "MemoCache.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// Use a table of label addresses instead of a switch where the compiler
+/// supports computed goto.
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_THREADED_DISPATCH 1
+#else
+#define VM_THREADED_DISPATCH 0
+#endif
+
+/// Executes a Program. All frames live in one register stack; a callee frame
+/// starts at the caller's argument registers, so calls copy nothing and do
+/// not recurse on the host stack.
+class VM {
+    struct Frame {
+        const Function *fn;
+        const Instr *retPC;  /// where the caller resumes
+        unsigned base;       /// first register of the frame
+        int retReg;          /// caller register receiving the result
+        /// Offset of the memo key of the call in mMemoKeys, -1 if its result
+        /// is not cached
+        int memo;
+        char *arrays;  /// local arrays in mArena, NULL until one is declared
+    };
+
+    const Program &mProgram;
+    std::vector<long> mRegs;
+    std::vector<Frame> mFrames;
+    std::vector<long> mGlobals;
+    /// Every address the program can point to, and its local arrays, global
+    /// arrays and heap
+    GuestMemory mMemory;
+    FrameArena mArena;
+    StaticArrays mStatics;
+    Heap *mHeap;
+    GuestIO *mIO;  /// where GET reads from and PRINT writes to
+    /// Cache of pure function results, NULL when memoization is off, and the
+    /// keys of the pending memoized calls: the function index followed by the
+    /// arguments
+    MemoCache *mMemo;
+    std::vector<long> mMemoKeys;
+    /// Bytes the registers and frames of the call stack may take
+    unsigned long mStackBudget;
+
+   public:
+    /// Guest memory reserves memoryReserve bytes of address space, the
+    /// default if 0
+    explicit VM(const Program &program, size_t memoryReserve = 0)
+        : mProgram(program),
+          mRegs(),
+          mFrames(),
+          mGlobals(program.numGlobals, 0),
+          mMemory(memoryReserve),
+          mArena(mMemory),
+          mStatics(mMemory),
+          mHeap(new Heap(mMemory)),
+          mIO(consoleIO()),
+          mMemo(NULL),
+          mMemoKeys(),
+          mStackBudget(~0UL) {}
+    ~VM() { delete mHeap; }
+
+    Heap *getHeap() { return mHeap; }
+
+    /// Read GET input from and write PRINT output to io
+    void setIO(GuestIO *io) { mIO = io; }
+
+    /// Stop the program instead of growing the call stack past bytes. A
+    /// frame takes exactly sizeof(Frame) plus 8 bytes per register of its
+    /// function.
+    void setStackBudget(unsigned long bytes) { mStackBudget = bytes; }
+
+    /// Cache the results of calls of pure functions in memo
+    void setMemo(MemoCache *memo) {
+        mMemo = memo;
+        for (unsigned i = 0; i < mProgram.functions.size(); i++)
+            if (mProgram.functions[i].pure)
+                memo->addFunction(&mProgram.functions[i],
+                                  mProgram.functions[i].name);
+    }
+
+    /// Initialize the globals and run main
+    long run() {
+        execute(mProgram.init);
+        return execute(mProgram.entry);
+    }
+
+    long execute(int index) {
+        const Function *fn = &mProgram.functions[index];
+        mFrames.clear();
+        mMemoKeys.clear();
+        mArena.clear();
+        if (mRegs.size() < fn->numRegs) mRegs.resize(fn->numRegs);
+        Frame entry = {fn, NULL, 0, 0, -1, NULL};
+        mFrames.push_back(entry);
+
+        const Instr *code = &fn->code[0];
+        const Instr *pc = code;
+        long *R = &mRegs[0];
+        long *G = mGlobals.empty() ? NULL : &mGlobals[0];
+        const long *K =
+            mProgram.constants.empty() ? NULL : &mProgram.constants[0];
+
+#if VM_THREADED_DISPATCH
+        static void *const dispatchTable[] = {
+#define VM_LABEL(name) &&L_##name,
+            BYTECODE_OPCODES(VM_LABEL)
+#undef VM_LABEL
+        };
+#define VM_CASE(name) L_##name:
+#define VM_DISPATCH() goto *dispatchTable[pc->op]
+        VM_DISPATCH();
+#else
+#define VM_CASE(name) case OP_##name:
+#define VM_DISPATCH() continue
+        for (;;) {
+            switch (pc->op) {
+#endif
+#define VM_NEXT()      \
+    {                  \
+        ++pc;          \
+        VM_DISPATCH(); \
+    }
+#define VM_JUMP(target)        \
+    {                          \
+        pc = code + (target);  \
+        VM_DISPATCH();         \
+    }
+#define VM_BINARY(name, expr)            \
+    VM_CASE(name) {                      \
+        long l = R[pc->b], r = R[pc->c]; \
+        R[pc->a] = (expr);               \
+        VM_NEXT();                       \
+    }
+#define VM_BRANCH(name, cmp)                       \
+    VM_CASE(name) {                                \
+        if (R[pc->a] cmp R[pc->b]) VM_JUMP(pc->c); \
+        VM_NEXT();                                 \
+    }
+
+        VM_CASE(Nop) { VM_NEXT(); }
+        VM_CASE(LoadImm) {
+            R[pc->a] = pc->c;
+            VM_NEXT();
+        }
+        VM_CASE(LoadConst) {
+            R[pc->a] = K[pc->c];
+            VM_NEXT();
+        }
+        VM_CASE(Mov) {
+            R[pc->a] = R[pc->b];
+            VM_NEXT();
+        }
+        VM_CASE(LoadGlobal) {
+            R[pc->a] = G[pc->c];
+            VM_NEXT();
+        }
+        VM_CASE(StoreGlobal) {
+            G[pc->c] = R[pc->a];
+            VM_NEXT();
+        }
+        VM_BINARY(Add, l + r)
+        VM_BINARY(Sub, l - r)
+        VM_BINARY(Mul, l * r)
+        VM_BINARY(Div, l / r)
+        VM_BINARY(Rem, l % r)
+        VM_BINARY(Lt, l < r)
+        VM_BINARY(Le, l <= r)
+        VM_BINARY(Gt, l > r)
+        VM_BINARY(Ge, l >= r)
+        VM_BINARY(Eq, l == r)
+        VM_BINARY(Ne, l != r)
+        VM_CASE(AddImm) {
+            R[pc->a] = R[pc->b] + pc->c;
+            VM_NEXT();
+        }
+        VM_CASE(MulImm) {
+            R[pc->a] = R[pc->b] * pc->c;
+            VM_NEXT();
+        }
+        VM_CASE(Neg) {
+            R[pc->a] = -R[pc->b];
+            VM_NEXT();
+        }
+        VM_CASE(Jmp) { VM_JUMP(pc->c); }
+        VM_CASE(JmpZ) {
+            if (R[pc->a] == 0) VM_JUMP(pc->c);
+            VM_NEXT();
+        }
+        VM_CASE(JmpNZ) {
+            if (R[pc->a] != 0) VM_JUMP(pc->c);
+            VM_NEXT();
+        }
+        VM_BRANCH(JLt, <)
+        VM_BRANCH(JLe, <=)
+        VM_BRANCH(JGt, >)
+        VM_BRANCH(JGe, >=)
+        VM_BRANCH(JEq, ==)
+        VM_BRANCH(JNe, !=)
+        VM_CASE(Load) {
+            R[pc->a] = mHeap->Get((long *)R[pc->b], pc->c);
+            VM_NEXT();
+        }
+        VM_CASE(Store) {
+            mHeap->Update((long *)R[pc->a], R[pc->b], pc->c);
+            VM_NEXT();
+        }
+        VM_CASE(LoadElem) {
+            R[pc->a] = ((long *)R[pc->b])[R[pc->c]];
+            VM_NEXT();
+        }
+        VM_CASE(StoreElem) {
+            ((long *)R[pc->a])[R[pc->b]] = R[pc->c];
+            VM_NEXT();
+        }
+        VM_CASE(LoadElemInt) {
+            R[pc->a] = ((int *)R[pc->b])[R[pc->c]];
+            VM_NEXT();
+        }
+        VM_CASE(StoreElemInt) {
+            ((int *)R[pc->a])[R[pc->b]] = (int)R[pc->c];
+            VM_NEXT();
+        }
+        VM_CASE(LoadElemChar) {
+            R[pc->a] = ((signed char *)R[pc->b])[R[pc->c]];
+            VM_NEXT();
+        }
+        VM_CASE(StoreElemChar) {
+            ((signed char *)R[pc->a])[R[pc->b]] = (signed char)R[pc->c];
+            VM_NEXT();
+        }
+        VM_CASE(NewArray) {
+            R[pc->a] = (long)mStatics.allocate(pc->c);
+            VM_NEXT();
+        }
+        VM_CASE(FrameArray) {
+            Frame &frame = mFrames.back();
+            if (!frame.arrays) frame.arrays = mArena.push(frame.fn->arrayBytes);
+            char *array = frame.arrays + pc->c;
+            ZeroPages::zero(array, pc->b);
+            R[pc->a] = (long)array;
+            VM_NEXT();
+        }
+        VM_CASE(Call) {
+            const Function *callee = &mProgram.functions[pc->b];
+            unsigned base = mFrames.back().base + pc->c;
+            int memo = -1;
+            if (callee->pure && mMemo) {
+                const long *args = R + pc->c;
+                if (mMemo->lookup(callee, args, callee->numParams, R[pc->a]))
+                    VM_NEXT();
+                memo = mMemoKeys.size();
+                mMemoKeys.push_back(pc->b);
+                mMemoKeys.insert(mMemoKeys.end(), args,
+                                 args + callee->numParams);
+            }
+            if (!reserve(base + callee->numRegs, mFrames.size() + 1))
+                return overflow();
+            Frame frame = {callee, pc + 1, base, pc->a, memo, NULL};
+            mFrames.push_back(frame);
+            R = &mRegs[base];
+            pc = code = &callee->code[0];
+            VM_DISPATCH();
+        }
+        VM_CASE(TailCall) {
+            // the arguments become the parameters of the reused frame
+            const Function *callee = &mProgram.functions[pc->b];
+            for (unsigned i = 0; i < callee->numParams; i++)
+                R[i] = R[pc->c + i];
+            Frame &frame = mFrames.back();
+            if (mRegs.size() < frame.base + callee->numRegs) {
+                if (!reserve(frame.base + callee->numRegs, mFrames.size()))
+                    return overflow();
+                R = &mRegs[frame.base];
+            }
+            frame.fn = callee;
+            pc = code = &callee->code[0];
+            VM_DISPATCH();
+        }
+        VM_CASE(Ret) {
+            long value = R[pc->a];
+            Frame done = mFrames.back();
+            mFrames.pop_back();
+            if (done.arrays) mArena.pop(done.arrays);
+            if (done.memo >= 0) memoize(done.memo, value);
+            if (mFrames.empty()) return value;
+            R = &mRegs[mFrames.back().base];
+            R[done.retReg] = value;
+            code = &mFrames.back().fn->code[0];
+            pc = done.retPC;
+            VM_DISPATCH();
+        }
+        VM_CASE(RetVoid) {
+            Frame done = mFrames.back();
+            mFrames.pop_back();
+            if (done.arrays) mArena.pop(done.arrays);
+            if (done.memo >= 0) memoize(done.memo, 0);
+            if (mFrames.empty()) return 0;
+            R = &mRegs[mFrames.back().base];
+            R[done.retReg] = 0;
+            code = &mFrames.back().fn->code[0];
+            pc = done.retPC;
+            VM_DISPATCH();
+        }
+        VM_CASE(Get) {
+            R[pc->a] = mIO->input();
+            VM_NEXT();
+        }
+        VM_CASE(Print) {
+            mIO->output(R[pc->a]);
+            VM_NEXT();
+        }
+        VM_CASE(Malloc) {
+            R[pc->a] = (long)mHeap->Malloc(R[pc->b]);
+            VM_NEXT();
+        }
+        VM_CASE(Free) {
+            mHeap->Free((long *)R[pc->a]);
+            VM_NEXT();
+        }
+        VM_CASE(Halt) { return 0; }
+
+#if !VM_THREADED_DISPATCH
+                default:
+                    return 0;
+            }
+        }
+#endif
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_NEXT
+#undef VM_JUMP
+#undef VM_BINARY
+#undef VM_BRANCH
+    }
+
+   private:
+    /// Make room for numRegs registers, doubling without going past the
+    /// budget. Returns false if numRegs registers and numFrames frames do not
+    /// fit in it.
+    bool reserve(unsigned long numRegs, unsigned long numFrames) {
+        if (numRegs * sizeof(long) + numFrames * sizeof(Frame) > mStackBudget)
+            return false;
+        if (mRegs.size() < numRegs)
+            mRegs.resize(std::max(
+                numRegs, std::min(2 * numRegs, mStackBudget / sizeof(long))));
+        return true;
+    }
+
+    long overflow() {
+        mIO->flush();
+        fprintf(stderr,
+                "Error: guest call stack exceeds its budget of %lu bytes at "
+                "depth %zu.\n",
+                mStackBudget, mFrames.size());
+        mFrames.clear();
+        return 0;
+    }
+
+    /// Cache the result of the memoized call whose key starts at offset
+    void memoize(int offset, long value) {
+        const Function *fn = &mProgram.functions[mMemoKeys[offset]];
+        mMemo->insert(fn, &mMemoKeys[offset + 1], fn->numParams, value);
+        mMemoKeys.resize(offset);
+    }
+};
+
+#endif
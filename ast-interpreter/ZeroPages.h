@@ -0,0 +1,56 @@
+//==--- ZeroPages.h - Clearing memory by handing its pages back -----------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_ZERO_PAGES_H
+#define AST_INTERPRETER_ZERO_PAGES_H
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/// Zeroing and releasing large ranges of guest memory (GuestMemory.h)
+/// without writing them. Whole pages are replaced by fresh anonymous ones,
+/// which read as zero and are only committed once written again, whatever
+/// backed them before: the pages of a restored snapshot included.
+class ZeroPages {
+   public:
+    /// Ranges at least this large are cleared by replacing their pages
+    static const size_t kThreshold = 256 << 10;
+
+    /// Zero bytes at mem, which must lie in guest memory
+    static void zero(char *mem, size_t bytes) {
+        if (bytes < kThreshold) {
+            memset(mem, 0, bytes);
+            return;
+        }
+        char *first, *last;
+        pages(mem, bytes, first, last);
+        memset(mem, 0, first - mem);
+        memset(last, 0, mem + bytes - last);
+        if (!discard(first, last - first)) memset(first, 0, last - first);
+    }
+
+    /// Hand the whole pages inside bytes at mem back to the kernel, leaving
+    /// them zero filled; the partial pages at the edges are kept
+    static void release(char *mem, size_t bytes) {
+        char *first, *last;
+        pages(mem, bytes, first, last);
+        if (first < last) discard(first, last - first);
+    }
+
+   private:
+    static void pages(char *mem, size_t bytes, char *&first, char *&last) {
+        long page = sysconf(_SC_PAGESIZE);
+        first = (char *)(((long)mem + page - 1) & ~(page - 1));
+        last = (char *)(((long)mem + (long)bytes) & ~(page - 1));
+        if (last < first) last = first;
+    }
+
+    /// Replace the pages of [mem, mem + bytes), page aligned, by zero ones
+    static bool discard(char *mem, size_t bytes) {
+        return mmap(mem, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE,
+                    -1, 0) != MAP_FAILED;
+    }
+};
+
+#endif
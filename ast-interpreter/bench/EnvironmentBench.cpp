@@ -0,0 +1,157 @@
+//==--- bench/EnvironmentBench.cpp - Microbenchmarks of the walker runtime ===//
+//===----------------------------------------------------------------------===//
+//
+// Measures the primitives every guest program leans on, one at a time: frame
+// slot binding and lookup, the guest heap, call/return round trips and the
+// evaluation of nested arithmetic. Guest code is parsed with Clang during
+// setup; only the primitive itself is timed.
+//
+//===----------------------------------------------------------------------===//
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Environment.h"
+#include "InterpreterVisitor.h"
+#include "benchmark/benchmark.h"
+#include "clang/Frontend/ASTUnit.h"
+
+using namespace clang;
+
+namespace {
+
+/// Declarations of the built-in functions every guest program starts with
+const char *kPrelude =
+    "extern int GET();\n"
+    "extern void * MALLOC(int);\n"
+    "extern void FREE(void *);\n"
+    "extern void PRINT(int);\n";
+
+/// A guest program parsed and loaded into an Environment, main's frame
+/// entered, and the walker running it
+struct Loaded {
+    std::unique_ptr<ASTUnit> ast;
+    Environment env;
+    InterpreterVisitor visitor;
+
+    explicit Loaded(const std::string &body) : visitor(&env) {
+        ast = tooling::buildASTFromCode(std::string(kPrelude) + body);
+        env.init(ast->getASTContext().getTranslationUnitDecl());
+    }
+
+    /// The expression statements of main, in order
+    std::vector<Expr *> mainExprs() {
+        std::vector<Expr *> exprs;
+        CompoundStmt *body = cast<CompoundStmt>(env.getEntry()->getBody());
+        for (Stmt *s : body->body())
+            if (Expr *e = dyn_cast<Expr>(s)) exprs.push_back(e);
+        return exprs;
+    }
+};
+
+/// A complete binary tree of + - * over x and literals, depth levels deep
+std::string tree(int depth, int &leaf) {
+    if (depth == 0) return leaf++ % 2 ? "x" : std::to_string(leaf);
+    static const char *ops[] = {" + ", " - ", " * "};
+    std::string lhs = tree(depth - 1, leaf);
+    std::string rhs = tree(depth - 1, leaf);
+    return "(" + lhs + ops[depth % 3] + rhs + ")";
+}
+
+}  // namespace
+
+/// Bind every slot of a frame of range(0) slots, then read them all back
+static void BM_FrameBindLookup(benchmark::State &state) {
+    Loaded p("int main() { return 0; }");
+    unsigned size = state.range(0);
+    for (auto _ : state) {
+        unsigned base = p.env.reserveFrame(size, size);
+        for (unsigned i = 0; i < size; i++) p.env.bindArg(base, i, i);
+        p.env.enter(base);
+        long sum = 0;
+        for (unsigned i = 0; i < size; i++) sum += p.env.local(i);
+        benchmark::DoNotOptimize(sum);
+        p.env.retstmt(sum);
+        p.env.ret(NULL);
+    }
+    state.SetItemsProcessed(state.iterations() * size * 2);
+}
+BENCHMARK(BM_FrameBindLookup)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+/// A heap holding range(0) live blocks of 1 to 64 cells, with one more large
+/// block so the slow path is populated too
+struct LiveHeap {
+    GuestMemory memory;
+    Heap heap;
+    std::vector<long *> blocks;
+    std::mt19937 rng;
+
+    explicit LiveHeap(unsigned live) : heap(memory), rng(42) {
+        for (unsigned i = 0; i < live; i++)
+            blocks.push_back(heap.Malloc(8 * (1 + rng() % 64)));
+        blocks.push_back(heap.Malloc(1 << 16));
+    }
+
+    long *pick() { return blocks[rng() % blocks.size()]; }
+};
+
+static void BM_HeapMallocFree(benchmark::State &state) {
+    LiveHeap h(state.range(0));
+    int size = 8 * state.range(1);
+    for (auto _ : state) {
+        long *p = h.heap.Malloc(size);
+        benchmark::DoNotOptimize(p);
+        h.heap.Free(p);
+    }
+}
+BENCHMARK(BM_HeapMallocFree)
+    ->ArgsProduct({{16, 1024, 65536}, {1, 32, 1024}});
+
+static void BM_HeapGetUpdate(benchmark::State &state) {
+    LiveHeap h(state.range(0));
+    for (auto _ : state) {
+        long *p = h.pick();
+        h.heap.Update(p, h.heap.Get(p) + 1);
+    }
+}
+BENCHMARK(BM_HeapGetUpdate)->Arg(16)->Arg(1024)->Arg(65536);
+
+static void BM_HeapCheck(benchmark::State &state) {
+    LiveHeap h(state.range(0));
+    for (auto _ : state) benchmark::DoNotOptimize(h.heap.check(h.pick()));
+}
+BENCHMARK(BM_HeapCheck)->Arg(16)->Arg(1024)->Arg(65536);
+
+/// Call, argument binding, return statement and return of a two parameter
+/// function, without running its body
+static void BM_CallRet(benchmark::State &state) {
+    Loaded p("int f(int a, int b) { int c; c = a; return c; }\n"
+             "int main() { f(1, 2); return 0; }");
+    CallExpr *call = cast<CallExpr>(p.mainExprs()[0]);
+    const QuickInfo *q = p.env.quicken(call);
+    for (auto _ : state) {
+        unsigned base = p.env.call(call, q);
+        p.env.bindArg(base, 0, 1);
+        p.env.bindArg(base, 1, 2);
+        p.env.enter(base);
+        p.env.retstmt(p.env.local(0));
+        benchmark::DoNotOptimize(p.env.ret(call));
+    }
+}
+BENCHMARK(BM_CallRet);
+
+/// Evaluate a complete tree of binary operators range(0) levels deep with
+/// InterpreterVisitor::Eval
+static void BM_BinopTree(benchmark::State &state) {
+    int leaf = 0;
+    Loaded p("int main() { int x; " + tree(state.range(0), leaf) +
+             "; return 0; }");
+    Expr *e = p.mainExprs()[0];
+    for (auto _ : state) benchmark::DoNotOptimize(p.visitor.Eval(e));
+    state.SetItemsProcessed(state.iterations() *
+                            ((1L << state.range(0)) - 1));
+}
+BENCHMARK(BM_BinopTree)->DenseRange(1, 10, 3);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,26 @@
+//==--- test/Check.h - Checks shared by the host tests -------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_TEST_CHECK_H
+#define AST_INTERPRETER_TEST_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/// Exit with a nonzero status, naming the failed condition, unless cond
+/// holds. ctest counts the test as failed.
+#define CHECK(cond)                                                      \
+    do {                                                                 \
+        if (!(cond)) {                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,       \
+                    __LINE__, #cond);                                    \
+            exit(1);                                                     \
+        }                                                                \
+    } while (0)
+
+/// Report a test whose checks all held, from its main()
+inline int allPassed(const char *test) {
+    printf("%s: all checks passed\n", test);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,103 @@
+//==--- test/InterpTest.cpp - Host test of the embedding API -------------===//
+//===----------------------------------------------------------------------===//
+//
+// Drives a small guest program through Interp.h the way a host would:
+// compile, arity, calls by name, state kept between calls until reset, and
+// GET and PRINT routed to callbacks. Exits with a nonzero status on the
+// first check that fails.
+//
+//===----------------------------------------------------------------------===//
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "Interp.h"
+
+static const char *kSource =
+    "extern int GET();\n"
+    "extern void * MALLOC(int);\n"
+    "extern void FREE(void *);\n"
+    "extern void PRINT(int);\n"
+    "int counter = 10;\n"
+    "int add(int a, int b) { return a + b; }\n"
+    "int bump() { counter = counter + 1; return counter; }\n"
+    "int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+    "int echo() { int x; x = GET(); PRINT(x * 2); return x; }\n"
+    "int main() { return 0; }\n";
+
+static void testCompile() {
+    CHECK(!interp::Program::compile("int main() { return undeclared; }"));
+    std::shared_ptr<const interp::Program> program =
+        interp::Program::compile(kSource);
+    CHECK(program);
+    CHECK(program->arity("add") == 2);
+    CHECK(program->arity("bump") == 0);
+    CHECK(program->arity("fib") == 1);
+    CHECK(program->arity("missing") == -1);
+    // the built-ins are declared, not defined
+    CHECK(program->arity("PRINT") == -1);
+    CHECK(!program->key().empty());
+    CHECK(interp::Program::compile(kSource)->key() == program->key());
+}
+
+static void testCall() {
+    interp::Instance instance(interp::Program::compile(kSource));
+    long result = -1;
+    CHECK(instance.call("add", {2, 3}, result));
+    CHECK(result == 5);
+    CHECK(instance.call("fib", {15}, result));
+    CHECK(result == 610);
+    // the result is left alone when the call is refused
+    result = -1;
+    CHECK(!instance.call("add", {1}, result));
+    CHECK(!instance.call("add", {1, 2, 3}, result));
+    CHECK(!instance.call("missing", {}, result));
+    CHECK(result == -1);
+}
+
+static void testReset() {
+    interp::Instance instance(interp::Program::compile(kSource));
+    long result;
+    CHECK(instance.call("bump", {}, result) && result == 11);
+    CHECK(instance.call("bump", {}, result) && result == 12);
+    instance.reset();
+    CHECK(instance.call("bump", {}, result) && result == 11);
+}
+
+static void testCallbacks() {
+    interp::Instance instance(interp::Program::compile(kSource));
+    std::vector<long> printed;
+    long next = 21;
+    instance.setIO([&next]() { return next++; },
+                   [&printed](long value) { printed.push_back(value); });
+    long result;
+    CHECK(instance.call("echo", {}, result) && result == 21);
+    CHECK(instance.call("echo", {}, result) && result == 22);
+    CHECK(printed.size() == 2 && printed[0] == 42 && printed[1] == 44);
+}
+
+static void testOptions() {
+    interp::Instance::Options options;
+    options.jitThreshold = 2;
+    options.stackBudget = 64 << 20;
+    interp::Instance instance(interp::Program::compile(kSource), options);
+    long result;
+    for (long i = 0; i < 10; i++) {
+        CHECK(instance.call("add", {i, 1}, result));
+        CHECK(result == i + 1);
+    }
+    CHECK(instance.call("fib", {20}, result) && result == 6765);
+}
+
+int main() {
+    testCompile();
+    testCall();
+    testReset();
+    testCallbacks();
+    testOptions();
+    return allPassed("interp-test");
+}
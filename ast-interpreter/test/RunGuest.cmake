@@ -0,0 +1,24 @@
+# Run a guest program of testcase/ and compare what it prints with the
+# //<value> lines it ends with:
+#   cmake -DINTERPRETER=<path> -DFLAGS=<flag;...> -DPROGRAM=<file.c>
+#         -P RunGuest.cmake
+file(READ ${PROGRAM} source)
+file(STRINGS ${PROGRAM} values REGEX "^//")
+set(expected "")
+foreach(value ${values})
+  string(SUBSTRING "${value}" 2 -1 value)
+  string(APPEND expected "${value}\n")
+endforeach()
+
+execute_process(
+  COMMAND ${INTERPRETER} ${FLAGS} --non-interactive "${source}"
+  INPUT_FILE /dev/null
+  OUTPUT_VARIABLE output
+  RESULT_VARIABLE result
+  )
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "${PROGRAM}: exited with ${result}")
+endif()
+if(NOT output STREQUAL expected)
+  message(FATAL_ERROR "${PROGRAM}: printed\n${output}expected\n${expected}")
+endif()
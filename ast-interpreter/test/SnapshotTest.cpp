@@ -0,0 +1,228 @@
+//==--- test/SnapshotTest.cpp - Host test of snapshot and restore ---------===//
+//===----------------------------------------------------------------------===//
+//
+// Runs a setup that fills a global table and builds a list on the heap,
+// snapshots the Instance, changes everything, and checks that restoring
+// brings back the globals, the heap contents and a heap that still
+// allocates and frees. Snapshots written to a file must read back the
+// same, and a snapshot of another program or a damaged file must be
+// refused.
+//
+//===----------------------------------------------------------------------===//
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "Interp.h"
+
+static const char *kSource =
+    "extern int GET();\n"
+    "extern void * MALLOC(int);\n"
+    "extern void FREE(void *);\n"
+    "extern void PRINT(int);\n"
+    "int table[1000];\n"
+    "int **head;\n"
+    "int count;\n"
+    "int push(int v) {\n"
+    "    int **node;\n"
+    "    int *value;\n"
+    "    node = (int **)MALLOC(sizeof(int *) * 2);\n"
+    "    value = (int *)MALLOC(sizeof(int));\n"
+    "    *value = v;\n"
+    "    node[0] = value;\n"
+    "    node[1] = (int *)head;\n"
+    "    head = node;\n"
+    "    count = count + 1;\n"
+    "    return count;\n"
+    "}\n"
+    "int pop() {\n"
+    "    int **node;\n"
+    "    int v;\n"
+    "    node = head;\n"
+    "    v = *node[0];\n"
+    "    head = (int **)node[1];\n"
+    "    FREE(node[0]);\n"
+    "    FREE((int *)node);\n"
+    "    count = count - 1;\n"
+    "    return v;\n"
+    "}\n"
+    "int setup(int n) {\n"
+    "    int i;\n"
+    "    i = 0;\n"
+    "    while (i < 1000) {\n"
+    "        table[i] = i * i;\n"
+    "        i = i + 1;\n"
+    "    }\n"
+    "    i = 0;\n"
+    "    while (i < n) {\n"
+    "        push(i);\n"
+    "        i = i + 1;\n"
+    "    }\n"
+    "    return count;\n"
+    "}\n"
+    "int sum() {\n"
+    "    int **node;\n"
+    "    int total;\n"
+    "    total = 0;\n"
+    "    node = head;\n"
+    "    while (node != 0) {\n"
+    "        total = total + *node[0];\n"
+    "        node = (int **)node[1];\n"
+    "    }\n"
+    "    return total;\n"
+    "}\n"
+    "int at(int i) { return table[i]; }\n"
+    "int mutate() {\n"
+    "    int i;\n"
+    "    i = 0;\n"
+    "    while (i < 1000) {\n"
+    "        table[i] = -1;\n"
+    "        i = i + 1;\n"
+    "    }\n"
+    "    pop();\n"
+    "    pop();\n"
+    "    push(1000);\n"
+    "    return count;\n"
+    "}\n"
+    "int report() { PRINT(count); return 0; }\n"
+    "int main() { return 0; }\n";
+
+static const long kNodes = 5000;
+/// sum() right after setup(kNodes)
+static const long kSum = kNodes * (kNodes - 1) / 2;
+
+static long call(interp::Instance &instance, const char *name,
+                 std::vector<long> args = std::vector<long>()) {
+    long result = 0;
+    CHECK(instance.call(name, args, result));
+    return result;
+}
+
+/// The state setup(kNodes) leaves
+static void checkSetUp(interp::Instance &instance) {
+    CHECK(call(instance, "at", {0}) == 0);
+    CHECK(call(instance, "at", {5}) == 25);
+    CHECK(call(instance, "at", {999}) == 999 * 999);
+    CHECK(call(instance, "sum") == kSum);
+    // the restored heap frees and allocates like the one that was saved
+    CHECK(call(instance, "pop") == kNodes - 1);
+    CHECK(call(instance, "push", {7}) == kNodes);
+    CHECK(call(instance, "sum") == kSum - (kNodes - 1) + 7);
+    CHECK(call(instance, "pop") == 7);
+    CHECK(call(instance, "push", {kNodes - 1}) == kNodes);
+}
+
+/// Change the globals and the heap, so a restore has to undo both
+static void mutate(interp::Instance &instance) {
+    CHECK(call(instance, "mutate") == kNodes - 1);
+    CHECK(call(instance, "at", {5}) == -1);
+    CHECK(call(instance, "sum") ==
+          kSum - (kNodes - 1) - (kNodes - 2) + 1000);
+}
+
+static void testMemory(std::shared_ptr<const interp::Program> program) {
+    interp::Instance instance(program);
+    CHECK(call(instance, "setup", {kNodes}) == kNodes);
+    std::shared_ptr<const interp::Snapshot> warm = instance.snapshot();
+    CHECK(warm);
+    for (int round = 0; round < 3; round++) {
+        mutate(instance);
+        CHECK(instance.restore(*warm));
+        checkSetUp(instance);
+    }
+    // reset drops the restored state
+    instance.reset();
+    CHECK(call(instance, "sum") == 0);
+    CHECK(instance.restore(*warm));
+    CHECK(call(instance, "sum") == kSum);
+}
+
+static void testBetweenCalls(std::shared_ptr<const interp::Program> program) {
+    interp::Instance instance(program);
+    CHECK(call(instance, "setup", {10}) == 10);
+    std::shared_ptr<const interp::Snapshot> warm = instance.snapshot();
+    CHECK(warm);
+    // PRINT runs inside report: neither may happen in the middle of it
+    bool snapshotted = true, restored = true;
+    instance.setIO([]() { return 0L; },
+                   [&](long) {
+                       snapshotted = instance.snapshot() != NULL;
+                       restored = instance.restore(*warm);
+                   });
+    call(instance, "report");
+    CHECK(!snapshotted && !restored);
+    CHECK(call(instance, "sum") == 45);
+}
+
+static bool copyFile(const std::string &from, const std::string &to,
+                     long truncate, long corruptAt) {
+    FILE *in = fopen(from.c_str(), "rb");
+    if (!in) return false;
+    std::vector<char> data;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(in);
+    if (truncate >= 0 && (size_t)truncate < data.size()) data.resize(truncate);
+    if (corruptAt >= 0 && (size_t)corruptAt < data.size())
+        data[corruptAt] ^= 0x5a;
+    FILE *out = fopen(to.c_str(), "wb");
+    if (!out) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+    return fclose(out) == 0 && ok;
+}
+
+static void testFile(std::shared_ptr<const interp::Program> program,
+                     const std::string &dir) {
+    std::string path = dir + "/warm.snap";
+    interp::Instance instance(program);
+    CHECK(call(instance, "setup", {kNodes}) == kNodes);
+    CHECK(instance.snapshot(path));
+    mutate(instance);
+    std::shared_ptr<const interp::Snapshot> warm =
+        interp::Snapshot::open(path);
+    CHECK(warm);
+    CHECK(instance.restore(*warm));
+    checkSetUp(instance);
+
+    // a snapshot only restores into its own program
+    std::shared_ptr<const interp::Program> other =
+        interp::Program::compile(std::string(kSource) + "int extra;\n");
+    CHECK(other && other->key() != program->key());
+    interp::Instance stranger(other);
+    CHECK(call(stranger, "setup", {3}) == 3);
+    CHECK(!stranger.restore(*warm));
+    // and leaves the other Instance alone
+    CHECK(call(stranger, "sum") == 3);
+
+    // damaged files are refused when opened
+    std::string damaged = dir + "/damaged.snap";
+    CHECK(copyFile(path, damaged, -1, 0));
+    CHECK(!interp::Snapshot::open(damaged));
+    CHECK(copyFile(path, damaged, 100, -1));
+    CHECK(!interp::Snapshot::open(damaged));
+    CHECK(copyFile(path, damaged, 4096, -1));
+    CHECK(!interp::Snapshot::open(damaged));
+    CHECK(!interp::Snapshot::open(dir + "/missing.snap"));
+    remove(damaged.c_str());
+    remove(path.c_str());
+}
+
+int main() {
+    std::shared_ptr<const interp::Program> program =
+        interp::Program::compile(kSource);
+    CHECK(program);
+    char dir[] = "/tmp/snapshot-test.XXXXXX";
+    CHECK(mkdtemp(dir));
+    testMemory(program);
+    testBetweenCalls(program);
+    testFile(program, dir);
+    rmdir(dir);
+    return allPassed("snapshot-test");
+}
@@ -0,0 +1,36 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int find(int n) {
+   int i;
+   for (i = 0; i < 100; i = i + 1) {
+      if (i * i >= n)
+         return i;
+   }
+   return -1;
+}
+
+int main() {
+   int i = 0;
+   int sum = 0;
+   while (1) {
+      i = i + 1;
+      if (i > 10) break;
+      if (i / 2 * 2 == i) continue;
+      sum = sum + i;
+   }
+   PRINT(sum);
+   for (i = 0; i < 5; i = i + 1) {
+      if (i == 2) continue;
+      PRINT(i);
+   }
+   PRINT(find(50));
+}
+//25
+//0
+//1
+//3
+//4
+//8
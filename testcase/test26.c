@@ -0,0 +1,31 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int sum(int n, int acc) {
+   if (n == 0)
+      return acc;
+   return sum(n - 1, acc + n);
+}
+
+int even(int n);
+
+int odd(int n) {
+   if (n == 0)
+      return 0;
+   return even(n - 1);
+}
+
+int even(int n) {
+   if (n == 0)
+      return 1;
+   return odd(n - 1);
+}
+
+int main() {
+   PRINT(sum(1000000, 0));
+   PRINT(even(100001));
+}
+//500000500000
+//0
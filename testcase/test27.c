@@ -0,0 +1,28 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int calls;
+
+int fib(int n) {
+   if (n < 2)
+      return n;
+   return fib(n - 1) + fib(n - 2);
+}
+
+int count(int n) {
+   calls = calls + 1;
+   return n;
+}
+
+int main() {
+   int i;
+   calls = 0;
+   PRINT(fib(30));
+   for (i = 0; i < 3; i = i + 1)
+      count(7);
+   PRINT(calls);
+}
+//832040
+//3
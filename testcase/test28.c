@@ -0,0 +1,34 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int main() {
+   int i;
+   int sum = 0;
+   int *a = (int *)MALLOC(sizeof(int) * 10);
+   char *q;
+   for (i = 0; i < 10; i = i + 1) {
+      *(a + i) = (2 + 3) * i - -1;
+      if (sizeof(int) == 4)
+         sum = sum + *(a + i);
+      else
+         sum = sum - 1000;
+      if (1 - 1)
+         sum = 0;
+   }
+   PRINT(sum);
+   PRINT(sizeof(int) * 10 + sizeof(int *));
+   PRINT(*(a + 9));
+   q = (char *)a;
+   PRINT(*(q + 4 * 7));
+   PRINT(*(q + 4 * 7 + 1));
+   while (0)
+      PRINT(-1);
+   FREE(a);
+}
+//235
+//48
+//46
+//36
+//0
@@ -0,0 +1,43 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int total;
+
+int step(int x) {
+   if (x / 2 * 2 == x)
+      return x / 2;
+   return 3 * x + 1;
+}
+
+int collatz(int x) {
+   int n = 0;
+   while (x != 1) {
+      x = step(x);
+      n = n + 1;
+   }
+   return n;
+}
+
+int main() {
+   int i;
+   int longest = 0;
+   int *p = (int *)MALLOC(sizeof(int));
+   *p = 0;
+   for (i = 1; i < 3000; i = i + 1) {
+      int n = collatz(i);
+      if (n > longest) {
+         longest = n;
+         *p = i;
+      }
+      total = total + n;
+   }
+   PRINT(longest);
+   PRINT(*p);
+   PRINT(total);
+   FREE(p);
+}
+//216
+//2919
+//215015
@@ -0,0 +1,15 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int depth(int n) {
+   if (n == 0) return 0;
+   return depth(n - 1) + 1;
+}
+
+int main() {
+   PRINT(depth(200000));
+   return 0;
+}
+//200000
@@ -0,0 +1,32 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int main() {
+   char buf[8];
+   int a[4];
+   int *p;
+   char *q;
+   PRINT(sizeof(buf));
+   PRINT(sizeof(a));
+   PRINT(sizeof(char) + sizeof(int) + sizeof(int *));
+   buf[1] = 200;
+   PRINT(buf[1]);
+   a[3] = 300;
+   q = (char *)a;
+   PRINT(q[12]);
+   PRINT(q[13]);
+   p = (int *)MALLOC(sizeof(int) * 4);
+   *(p + 3) = 7;
+   q = (char *)p;
+   PRINT(*(q + 12));
+   FREE(p);
+}
+//8
+//16
+//13
+//-56
+//44
+//1
+//7
@@ -0,0 +1,31 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int fill(int *a, int n) {
+   int i;
+   for (i = 0; i < n; i = i + 1)
+      a[i] = i;
+   return a[n - 1];
+}
+
+int walk(int n) {
+   int a[16];
+   a[0] = n;
+   if (n > 0)
+      walk(n - 1);
+   return a[0] + fill(a, 16);
+}
+
+int main() {
+   int i;
+   int sum = 0;
+   for (i = 0; i < 100000; i = i + 1) {
+      char buf[64];
+      buf[63] = 1;
+      sum = sum + walk(3) + buf[63] - 1;
+   }
+   PRINT(sum);
+}
+//1800000
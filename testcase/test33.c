@@ -0,0 +1,26 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int table[50000000];
+
+int probe(int i) {
+   int window[100000];
+   int old = window[i];
+   window[i] = i;
+   return old + window[i];
+}
+
+int main() {
+   int i;
+   table[49999999] = 5;
+   table[12345678] = table[49999999] * 2;
+   PRINT(table[12345678] + table[0]);
+   for (i = 0; i < 3; i = i + 1)
+      PRINT(probe(99999 - i));
+}
+//10
+//99999
+//99998
+//99997
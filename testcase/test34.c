@@ -0,0 +1,27 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int rem(int a, int b) {
+   return a % b;
+}
+
+int main() {
+   int a;
+   int b;
+   a = 17;
+   b = 5;
+   PRINT(17 % 5);
+   PRINT(a % b);
+   PRINT(a / b);
+   PRINT(-a % b);
+   PRINT(rem(100, 7));
+   PRINT(rem(a * 3, b + 1));
+}
+//2
+//2
+//3
+//-2
+//2
+//3